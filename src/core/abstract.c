@@ -105,6 +105,14 @@ static int32_t janet_decref(JanetAbstractHead *ab) {
     return InterlockedDecrement(&ab->gc.data.refcount);
 }
 
+void *janet_atomic_load_ptr(void **ptr) {
+    return InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+int janet_atomic_cas_ptr(void **ptr, void *expected, void *desired) {
+    return InterlockedCompareExchangePointer(ptr, desired, expected) == expected;
+}
+
 void janet_os_mutex_init(JanetOSMutex *mutex) {
     InitializeCriticalSection((CRITICAL_SECTION *) mutex);
 }
@@ -165,6 +173,14 @@ static int32_t janet_decref(JanetAbstractHead *ab) {
     return __atomic_add_fetch(&ab->gc.data.refcount, -1, __ATOMIC_RELAXED);
 }
 
+void *janet_atomic_load_ptr(void **ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+int janet_atomic_cas_ptr(void **ptr, void *expected, void *desired) {
+    return __atomic_compare_exchange_n(ptr, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
 void janet_os_mutex_init(JanetOSMutex *mutex) {
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
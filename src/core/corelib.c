@@ -257,6 +257,19 @@ JANET_CORE_FN(janet_core_expand_path,
     return janet_wrap_buffer(out);
 }
 
+JANET_CORE_FN(janet_core_core_value,
+              "(module/core-value sym)",
+              "Get the value bound to `sym` in the core environment of the current thread, "
+              "creating the environment if it does not exist yet. Functions started with "
+              "`ev/thread` can use this to call core functions by name instead of carrying "
+              "copies of them. Returns nil if `sym` is not bound.") {
+    janet_fixarity(argc, 1);
+    const uint8_t *sym = janet_getsymbol(argv, 0);
+    Janet out = janet_wrap_nil();
+    janet_resolve(janet_core_env(NULL), sym, &out);
+    return out;
+}
+
 JANET_CORE_FN(janet_core_dyn,
               "(dyn key &opt default)",
               "Get a dynamic binding. Returns the default value (or nil) if no binding found.") {
@@ -522,6 +535,27 @@ JANET_CORE_FN(janet_core_gcinterval,
     return janet_wrap_number((double) janet_vm.gc_interval);
 }
 
+JANET_CORE_FN(janet_core_gcstats,
+              "(gcstats)",
+              "Returns a struct of garbage collection statistics since the VM started, "
+              "with the number of objects allocated as :allocations, the number of bytes "
+              "allocated as :bytes, the number of live objects as :blocks, and the number "
+              "of collections as :collections.") {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    /* Read the counters before allocating the result */
+    double allocations = (double) janet_vm.gc_allocations;
+    double bytes = (double)(janet_vm.gc_allocated + janet_vm.next_collection);
+    double blocks = (double) janet_vm.block_count;
+    double collections = (double) janet_vm.gc_collections;
+    JanetKV *st = janet_struct_begin(4);
+    janet_struct_put(st, janet_ckeywordv("allocations"), janet_wrap_number(allocations));
+    janet_struct_put(st, janet_ckeywordv("bytes"), janet_wrap_number(bytes));
+    janet_struct_put(st, janet_ckeywordv("blocks"), janet_wrap_number(blocks));
+    janet_struct_put(st, janet_ckeywordv("collections"), janet_wrap_number(collections));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
 JANET_CORE_FN(janet_core_type,
               "(type x)",
               "Returns the type of `x` as a keyword. `x` is one of:\n\n"
@@ -956,6 +990,7 @@ static void janet_load_libs(JanetTable *env) {
         JANET_CORE_REG("gccollect", janet_core_gccollect),
         JANET_CORE_REG("gcsetinterval", janet_core_gcsetinterval),
         JANET_CORE_REG("gcinterval", janet_core_gcinterval),
+        JANET_CORE_REG("gcstats", janet_core_gcstats),
         JANET_CORE_REG("type", janet_core_type),
         JANET_CORE_REG("hash", janet_core_hash),
         JANET_CORE_REG("getline", janet_core_getline),
@@ -964,6 +999,7 @@ static void janet_load_libs(JanetTable *env) {
         JANET_CORE_REG("trace", janet_core_trace),
         JANET_CORE_REG("untrace", janet_core_untrace),
         JANET_CORE_REG("module/expand-path", janet_core_expand_path),
+        JANET_CORE_REG("module/core-value", janet_core_core_value),
         JANET_CORE_REG("int?", janet_core_check_int),
         JANET_CORE_REG("nat?", janet_core_check_nat),
         JANET_CORE_REG("slice", janet_core_slice),
@@ -1188,11 +1224,12 @@ JanetTable *janet_core_env(JanetTable *replacements) {
 
     JanetTable *dict = janet_core_lookup_table(replacements);
 
-    /* Unmarshal bytecode */
+    /* Unmarshal bytecode. The image is generated by the build, so the
+     * bytecode was already verified when it was compiled. */
     Janet marsh_out = janet_unmarshal(
                           janet_core_image,
                           janet_core_image_size,
-                          0,
+                          JANET_MARSHAL_NO_VERIFY | JANET_MARSHAL_SHARE_SOURCEMAPS,
                           dict,
                           NULL);
 
@@ -3064,8 +3064,13 @@ JANET_CORE_FN(janet_cfun_stream_write,
         janet_ev_write_buffer(stream, janet_getbuffer(argv, 1));
     } else {
         JanetByteView bytes = janet_getbytes(argv, 1);
+        /* Abstract byte sequences, such as string views, are copied into a
+         * string, which is what the pending write keeps alive */
+        JanetString str = janet_checktype(argv[1], JANET_ABSTRACT)
+                          ? janet_string(bytes.bytes, bytes.len)
+                          : bytes.bytes;
         if (to != INFINITY) janet_addtimeout(to);
-        janet_ev_write_string(stream, bytes.bytes);
+        janet_ev_write_string(stream, str);
     }
     janet_await();
 }
@@ -48,10 +48,24 @@ static void fiber_reset(JanetFiber *fiber) {
 
 static JanetFiber *fiber_alloc(int32_t capacity) {
     Janet *data;
-    JanetFiber *fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
+    JanetFiber *fiber;
     if (capacity < 32) {
         capacity = 32;
     }
+    if (NULL != janet_vm.fiber_pool) {
+        /* Reuse a dead fiber and its stack if it is large enough */
+        fiber = janet_vm.fiber_pool;
+        janet_vm.fiber_pool = (JanetFiber *) fiber->gc.data.next;
+        janet_vm.fiber_pool_count--;
+        janet_gclink(&fiber->gc, JANET_MEMORY_FIBER, sizeof(JanetFiber));
+        if (fiber->capacity >= capacity) {
+            janet_vm.next_collection += sizeof(Janet) * fiber->capacity;
+            return fiber;
+        }
+        janet_free(fiber->data);
+    } else {
+        fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
+    }
     fiber->capacity = capacity;
     data = janet_malloc(sizeof(Janet) * (size_t) capacity);
     if (NULL == data) {
@@ -62,6 +76,32 @@ static JanetFiber *fiber_alloc(int32_t capacity) {
     return fiber;
 }
 
+/* Called by the garbage collector on fibers that are no longer reachable. */
+void janet_fiber_recycle(JanetFiber *fiber) {
+    if (janet_vm.fiber_pool_count >= JANET_FIBER_POOL_SIZE ||
+            fiber->capacity > JANET_FIBER_POOL_MAX_CAPACITY) {
+        janet_free(fiber->data);
+        janet_free(fiber);
+        return;
+    }
+    fiber->gc.data.next = (JanetGCObject *) janet_vm.fiber_pool;
+    janet_vm.fiber_pool = fiber;
+    janet_vm.fiber_pool_count++;
+}
+
+/* Free all pooled fibers */
+void janet_fiber_pool_clear(void) {
+    JanetFiber *fiber = janet_vm.fiber_pool;
+    while (NULL != fiber) {
+        JanetFiber *next = (JanetFiber *) fiber->gc.data.next;
+        janet_free(fiber->data);
+        janet_free(fiber);
+        fiber = next;
+    }
+    janet_vm.fiber_pool = NULL;
+    janet_vm.fiber_pool_count = 0;
+}
+
 /* Create a new fiber with argn values on the stack by reusing a fiber. */
 JanetFiber *janet_fiber_reset(JanetFiber *fiber, JanetFunction *callee, int32_t argc, const Janet *argv) {
     int32_t newstacktop;
@@ -253,27 +293,38 @@ static void janet_env_detach(JanetFuncEnv *env) {
     if (env) {
         janet_env_valid(env);
         int32_t len = env->length;
+        Janet *values = env->as.fiber->data + env->offset;
+        uint32_t *bitset = janet_stack_frame(values)->func->def->closure_bitset;
+        if (bitset) {
+            /* Closures can only reference captured slots, so drop
+             * the slots after the last one that is captured. */
+            int32_t i = (len + 31) >> 5;
+            while (i > 0 && !bitset[i - 1]) i--;
+            if (i > 0) {
+                uint32_t chunk = bitset[i - 1];
+                int32_t top = (i - 1) << 5;
+                while (chunk >>= 1) top++;
+                if (top + 1 < len) len = top + 1;
+            }
+        }
         size_t s = sizeof(Janet) * (size_t) len;
         Janet *vmem = janet_malloc(s);
         janet_vm.next_collection += (uint32_t) s;
         if (NULL == vmem) {
             JANET_OUT_OF_MEMORY;
         }
-        Janet *values = env->as.fiber->data + env->offset;
-        safe_memcpy(vmem, values, s);
-        uint32_t *bitset = janet_stack_frame(values)->func->def->closure_bitset;
         if (bitset) {
-            /* Clear unneeded references in closure environment */
-            for (int32_t i = 0; i < len; i += 32) {
-                uint32_t mask = ~(bitset[i >> 5]);
-                int32_t maxj = i + 32 > len ? len : i + 32;
-                for (int32_t j = i; j < maxj; j++) {
-                    if (mask & 1) vmem[j] = janet_wrap_nil();
-                    mask >>= 1;
-                }
+            /* Only copy captured slots, leaving no references to the rest */
+            for (int32_t i = 0; i < len; i++) {
+                vmem[i] = (bitset[i >> 5] & (1u << (i & 0x1F)))
+                          ? values[i]
+                          : janet_wrap_nil();
             }
+        } else {
+            safe_memcpy(vmem, values, s);
         }
         env->offset = 0;
+        env->length = len;
         env->as.values = vmem;
     }
 }
@@ -65,8 +65,20 @@
     (f)->flags |= (s) << JANET_FIBER_STATUS_OFFSET;\
 } while (0)
 
+/* Dead fibers are kept in a per thread pool so that new fibers
+ * can reuse them and their stacks without calling malloc. Stacks
+ * that grew past JANET_FIBER_POOL_MAX_CAPACITY are not kept. */
+#ifndef JANET_FIBER_POOL_SIZE
+#define JANET_FIBER_POOL_SIZE 512
+#endif
+#ifndef JANET_FIBER_POOL_MAX_CAPACITY
+#define JANET_FIBER_POOL_MAX_CAPACITY 1024
+#endif
+
 #define janet_stack_frame(s) ((JanetStackFrame *)((s) - JANET_FRAME_SIZE))
 #define janet_fiber_frame(f) janet_stack_frame((f)->data + (f)->frame)
+void janet_fiber_recycle(JanetFiber *fiber);
+void janet_fiber_pool_clear(void);
 void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n);
 void janet_fiber_push(JanetFiber *fiber, Janet x);
 void janet_fiber_push2(JanetFiber *fiber, Janet x, Janet y);
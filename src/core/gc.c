@@ -97,7 +97,10 @@ void janet_mark(Janet x) {
 }
 
 static void janet_mark_string(const uint8_t *str) {
-    janet_gc_mark(janet_string_head(str));
+    JanetStringHead *head = janet_string_head(str);
+    /* Static strings live in read only memory mapped images and are never collected */
+    if (!(head->gc.flags & JANET_MEM_STATIC))
+        janet_gc_mark(head);
 }
 
 static void janet_mark_buffer(JanetBuffer *buffer) {
@@ -312,7 +315,8 @@ static void janet_deinit_block(JanetGCObject *mem) {
             janet_free(def->environments);
             janet_free(def->constants);
             janet_free(def->bytecode);
-            janet_free(def->sourcemap);
+            if (!(def->flags & JANET_FUNCDEF_FLAG_SHAREDSOURCEMAP))
+                janet_free(def->sourcemap);
             janet_free(def->closure_bitset);
         }
         break;
@@ -332,13 +336,18 @@ void janet_sweep() {
             current->flags &= ~JANET_MEM_REACHABLE;
         } else {
             janet_vm.block_count--;
-            janet_deinit_block(current);
             if (NULL != previous) {
                 previous->data.next = next;
             } else {
                 janet_vm.blocks = next;
             }
-            janet_free(current);
+            if ((current->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FIBER) {
+                /* Dead fibers are pooled for reuse */
+                janet_fiber_recycle((JanetFiber *) current);
+            } else {
+                janet_deinit_block(current);
+                janet_free(current);
+            }
         }
         current = next;
     }
@@ -393,6 +402,14 @@ void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
         JANET_OUT_OF_MEMORY;
     }
 
+    janet_gclink(mem, type, size);
+
+    return (void *)mem;
+}
+
+/* Add a block of memory to the heap list */
+void janet_gclink(JanetGCObject *mem, enum JanetMemoryType type, size_t size) {
+
     /* Configure block */
     mem->flags = type;
 
@@ -401,8 +418,7 @@ void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
     mem->data.next = janet_vm.blocks;
     janet_vm.blocks = mem;
     janet_vm.block_count++;
-
-    return (void *)mem;
+    janet_vm.gc_allocations++;
 }
 
 static void free_one_scratch(JanetScratch *s) {
@@ -445,11 +461,17 @@ void janet_collect(void) {
     janet_mark_fiber(janet_vm.root_fiber);
     for (i = 0; i < orig_rootcount; i++)
         janet_mark(janet_vm.roots[i]);
+#ifdef JANET_PEG
+    janet_peg_cache_mark();
+#endif
     while (orig_rootcount < janet_vm.root_count) {
         Janet x = janet_vm.roots[--janet_vm.root_count];
         janet_mark(x);
     }
+    janet_string_views_mark();
     janet_sweep();
+    janet_vm.gc_allocated += janet_vm.next_collection;
+    janet_vm.gc_collections++;
     janet_vm.next_collection = 0;
     janet_free_all_scratch();
 }
@@ -540,6 +562,7 @@ void janet_clear_memory(void) {
         current = next;
     }
     janet_vm.blocks = NULL;
+    janet_fiber_pool_clear();
     janet_free_all_scratch();
     janet_free(janet_vm.scratch_mem);
 }
@@ -34,6 +34,7 @@
 #define JANET_MEM_TYPEBITS 0xFF
 #define JANET_MEM_REACHABLE 0x100
 #define JANET_MEM_DISABLED 0x200
+#define JANET_MEM_STATIC 0x400
 
 #define janet_gc_settype(m, t) ((janet_gc_header(m)->flags |= (0xFF & (t))))
 #define janet_gc_type(m) (janet_gc_header(m)->flags & 0xFF)
@@ -63,4 +64,8 @@ enum JanetMemoryType {
  * and then call when janet_enablegc when it is initailize and reachable by the gc (on the JANET stack) */
 void *janet_gcalloc(enum JanetMemoryType type, size_t size);
 
+/* Track an already allocated block of memory in the heap, such as one
+ * taken from a free list. */
+void janet_gclink(JanetGCObject *mem, enum JanetMemoryType type, size_t size);
+
 #endif
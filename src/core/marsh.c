@@ -28,16 +28,33 @@
 #include "gc.h"
 #include "fiber.h"
 #include "util.h"
+#include "symcache.h"
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef JANET_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 typedef struct {
     JanetBuffer *buf;
+    uint8_t *zbuf; /* Scratch block for compressing to a file, or NULL */
+    FILE *file;
     JanetTable seen;
     JanetTable *rreg;
-    JanetFuncEnv **seen_envs;
-    JanetFuncDef **seen_defs;
+    JanetTable seen_envs;
+    JanetTable seen_defs;
     int32_t nextid;
     int maybe_cycles;
+    int64_t offset; /* Position of st->buf in the message */
 } MarshalState;
 
 /* Lead bytes in marshaling protocol */
@@ -67,8 +84,10 @@ enum {
     LB_UNSAFE_POINTER, /* 222 */
     LB_STRUCT_PROTO, /* 223 */
 #ifdef JANET_EV
-    LB_THREADED_ABSTRACT/* 224 */
+    LB_THREADED_ABSTRACT, /* 224 */
 #endif
+    LB_COMPRESSED = 225, /* 225 */
+    LB_STATIC_STRING = 226 /* 226 */
 } LeadBytes;
 
 /* Helper to look inside an entry in an environment */
@@ -125,26 +144,38 @@ JanetTable *janet_env_lookup(JanetTable *env) {
     return renv;
 }
 
-/* Marshal an integer onto the buffer */
-static void pushint(MarshalState *st, int32_t x) {
+/* Encode an integer in at most 5 bytes, returning its length */
+static int32_t encodeint(uint8_t *intbuf, int32_t x) {
     if (x >= 0 && x < 128) {
-        janet_buffer_push_u8(st->buf, x);
+        intbuf[0] = (uint8_t) x;
+        return 1;
     } else if (x <= 8191 && x >= -8192) {
-        uint8_t intbuf[2];
         intbuf[0] = ((x >> 8) & 0x3F) | 0x80;
         intbuf[1] = x & 0xFF;
-        janet_buffer_push_bytes(st->buf, intbuf, 2);
+        return 2;
+    }
+    intbuf[0] = LB_INTEGER;
+    intbuf[1] = (x >> 24) & 0xFF;
+    intbuf[2] = (x >> 16) & 0xFF;
+    intbuf[3] = (x >> 8) & 0xFF;
+    intbuf[4] = x & 0xFF;
+    return 5;
+}
+
+/* Marshal an integer onto a buffer */
+static void buffer_pushint(JanetBuffer *buf, int32_t x) {
+    if (x >= 0 && x < 128) {
+        janet_buffer_push_u8(buf, x);
     } else {
         uint8_t intbuf[5];
-        intbuf[0] = LB_INTEGER;
-        intbuf[1] = (x >> 24) & 0xFF;
-        intbuf[2] = (x >> 16) & 0xFF;
-        intbuf[3] = (x >> 8) & 0xFF;
-        intbuf[4] = x & 0xFF;
-        janet_buffer_push_bytes(st->buf, intbuf, 5);
+        janet_buffer_push_bytes(buf, intbuf, encodeint(intbuf, x));
     }
 }
 
+static void pushint(MarshalState *st, int32_t x) {
+    buffer_pushint(st->buf, x);
+}
+
 static void pushbyte(MarshalState *st, uint8_t b) {
     janet_buffer_push_u8(st->buf, b);
 }
@@ -153,6 +184,176 @@ static void pushbytes(MarshalState *st, const uint8_t *bytes, int32_t len) {
     janet_buffer_push_bytes(st->buf, bytes, len);
 }
 
+/*
+ * Compression
+ *
+ * A compressed message is LB_COMPRESSED followed by blocks holding at most
+ * JANET_MARSHAL_BLOCK_SIZE bytes of ordinary marshalled data each. A block is
+ * its uncompressed length, its compressed length and the compressed bytes. A
+ * zero length ends the message. Blocks use the LZ4 block format: a sequence is
+ * a token with literal and match lengths, the literals, and a two byte offset
+ * back to the start of the match. Blocks are compressed independently.
+ */
+
+#define JANET_MARSHAL_BLOCK_SIZE 0x10000
+/* Largest compressed size of a block, with room for its two lengths in front */
+#define JANET_MARSHAL_ZBLOCK_SIZE (JANET_MARSHAL_BLOCK_SIZE + JANET_MARSHAL_BLOCK_SIZE / 255 + 32)
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+static uint32_t lz_read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static uint8_t *lz_push_length(uint8_t *out, int32_t n) {
+    while (n >= 255) {
+        *out++ = 255;
+        n -= 255;
+    }
+    *out++ = (uint8_t) n;
+    return out;
+}
+
+/* A match length of 0 marks the final literals of a block */
+static uint8_t *lz_push_sequence(uint8_t *out, const uint8_t *literals, int32_t litlen,
+                                 int32_t offset, int32_t matchlen) {
+    int32_t ml = matchlen ? matchlen - LZ_MIN_MATCH : 0;
+    *out++ = (uint8_t)(((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15));
+    if (litlen >= 15) out = lz_push_length(out, litlen - 15);
+    safe_memcpy(out, literals, litlen);
+    out += litlen;
+    if (matchlen) {
+        *out++ = offset & 0xFF;
+        *out++ = (offset >> 8) & 0xFF;
+        if (ml >= 15) out = lz_push_length(out, ml - 15);
+    }
+    return out;
+}
+
+/* Compress a block into out, which has room for LZ4's worst case of
+ * len + len / 255 + 16 bytes. Returns the compressed length. */
+static int32_t lz_compress(uint8_t *out, const uint8_t *src, int32_t len) {
+    uint8_t *start = out;
+    int32_t table[1 << LZ_HASH_BITS];
+    for (int32_t i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+    int32_t anchor = 0;
+    int32_t i = 0;
+    /* Like LZ4, leave the tail of the block as literals */
+    int32_t limit = len - 12;
+    int32_t matchlimit = len - 5;
+    while (i < limit) {
+        uint32_t seq = lz_read32(src + i);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int32_t ref = table[h];
+        table[h] = i;
+        if (ref >= 0 && i - ref <= 0xFFFF && lz_read32(src + ref) == seq) {
+            int32_t matchlen = LZ_MIN_MATCH;
+            while (i + matchlen < matchlimit && src[ref + matchlen] == src[i + matchlen]) matchlen++;
+            out = lz_push_sequence(out, src + anchor, i - anchor, i - ref, matchlen);
+            i += matchlen;
+            anchor = i;
+        } else {
+            i++;
+        }
+    }
+    out = lz_push_sequence(out, src + anchor, len - anchor, 0, 0);
+    return (int32_t)(out - start);
+}
+
+/* Returns non-zero if the block is invalid */
+static int lz_decompress(const uint8_t *src, int32_t srclen, uint8_t *dest, int32_t destlen) {
+    const uint8_t *end = src + srclen;
+    int32_t d = 0;
+    while (src < end) {
+        uint8_t token = *src++;
+        int32_t litlen = token >> 4;
+        if (litlen == 15) {
+            uint8_t b;
+            do {
+                if (src >= end || litlen > destlen) return 1;
+                b = *src++;
+                litlen += b;
+            } while (b == 255);
+        }
+        if (litlen > end - src || litlen > destlen - d) return 1;
+        memcpy(dest + d, src, litlen);
+        d += litlen;
+        src += litlen;
+        if (src == end) break;
+        if (end - src < 2) return 1;
+        int32_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        if (offset == 0 || offset > d) return 1;
+        int32_t matchlen = token & 15;
+        if (matchlen == 15) {
+            uint8_t b;
+            do {
+                if (src >= end || matchlen > destlen) return 1;
+                b = *src++;
+                matchlen += b;
+            } while (b == 255);
+        }
+        matchlen += LZ_MIN_MATCH;
+        if (matchlen > destlen - d) return 1;
+        for (int32_t i = 0; i < matchlen; i++) {
+            dest[d + i] = dest[d - offset + i];
+        }
+        d += matchlen;
+    }
+    return d != destlen;
+}
+
+/* Compress one block into the scratch block zbuf of JANET_MARSHAL_ZBLOCK_SIZE
+ * bytes, and return where the block starts. The lengths are written just in
+ * front of the compressed bytes, so the whole block is contiguous. */
+static uint8_t *marshal_compress_block(uint8_t *zbuf, const uint8_t *src, int32_t n, int32_t *len) {
+    int32_t complen = lz_compress(zbuf + 10, src, n);
+    uint8_t lengths[10];
+    int32_t headlen = encodeint(lengths, n);
+    headlen += encodeint(lengths + headlen, complen);
+    uint8_t *block = zbuf + 10 - headlen;
+    memcpy(block, lengths, headlen);
+    *len = headlen + complen;
+    return block;
+}
+
+/* Push compressed blocks for some marshalled bytes */
+static void marshal_compress(JanetBuffer *out, uint8_t *zbuf, const uint8_t *src, int32_t len) {
+    for (int32_t i = 0; i < len; i += JANET_MARSHAL_BLOCK_SIZE) {
+        int32_t n = len - i < JANET_MARSHAL_BLOCK_SIZE ? len - i : JANET_MARSHAL_BLOCK_SIZE;
+        int32_t blocklen;
+        const uint8_t *block = marshal_compress_block(zbuf, src + i, n, &blocklen);
+        janet_buffer_push_bytes(out, block, blocklen);
+    }
+}
+
+static void marshal_write(MarshalState *st, const uint8_t *bytes, int32_t len) {
+    if (fwrite(bytes, 1, (size_t) len, st->file) != (size_t) len) {
+        janet_panic("could not write marshalled data to file");
+    }
+}
+
+/* Write out the buffered bytes when marshalling to a file */
+static void marshal_flush(MarshalState *st) {
+    if (st->buf->count) {
+        if (st->zbuf) {
+            for (int32_t i = 0; i < st->buf->count; i += JANET_MARSHAL_BLOCK_SIZE) {
+                int32_t n = st->buf->count - i;
+                if (n > JANET_MARSHAL_BLOCK_SIZE) n = JANET_MARSHAL_BLOCK_SIZE;
+                int32_t blocklen;
+                const uint8_t *block = marshal_compress_block(st->zbuf, st->buf->data + i, n, &blocklen);
+                marshal_write(st, block, blocklen);
+            }
+        } else {
+            marshal_write(st, st->buf->data, st->buf->count);
+        }
+        st->offset += st->buf->count;
+        st->buf->count = 0;
+    }
+}
+
 /* Marshal a size_t onto the buffer */
 static void push64(MarshalState *st, uint64_t x) {
     if (x <= 0xF0) {
@@ -183,15 +384,14 @@ static void marshal_one_env(MarshalState *st, JanetFuncEnv *env, int flags);
 /* Marshal a function env */
 static void marshal_one_env(MarshalState *st, JanetFuncEnv *env, int flags) {
     MARSH_STACKCHECK;
-    for (int32_t i = 0; i < janet_v_count(st->seen_envs); i++) {
-        if (st->seen_envs[i] == env) {
-            pushbyte(st, LB_FUNCENV_REF);
-            pushint(st, i);
-            return;
-        }
+    Janet check = janet_table_get(&st->seen_envs, janet_wrap_pointer(env));
+    if (janet_checktype(check, JANET_NUMBER)) {
+        pushbyte(st, LB_FUNCENV_REF);
+        pushint(st, janet_unwrap_integer(check));
+        return;
     }
     janet_env_valid(env);
-    janet_v_push(st->seen_envs, env);
+    janet_table_put(&st->seen_envs, janet_wrap_pointer(env), janet_wrap_integer(st->seen_envs.count));
     if (env->offset > 0 && (JANET_STATUS_ALIVE == janet_fiber_status(env->as.fiber))) {
         pushint(st, 0);
         pushint(st, env->length);
@@ -232,16 +432,15 @@ static void janet_marshal_u32s(MarshalState *st, const uint32_t *u32s, int32_t n
 /* Marshal a function def */
 static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     MARSH_STACKCHECK;
-    for (int32_t i = 0; i < janet_v_count(st->seen_defs); i++) {
-        if (st->seen_defs[i] == def) {
-            pushbyte(st, LB_FUNCDEF_REF);
-            pushint(st, i);
-            return;
-        }
+    Janet check = janet_table_get(&st->seen_defs, janet_wrap_pointer(def));
+    if (janet_checktype(check, JANET_NUMBER)) {
+        pushbyte(st, LB_FUNCDEF_REF);
+        pushint(st, janet_unwrap_integer(check));
+        return;
     }
     /* Add to lookup */
-    janet_v_push(st->seen_defs, def);
-    pushint(st, def->flags);
+    janet_table_put(&st->seen_defs, janet_wrap_pointer(def), janet_wrap_integer(st->seen_defs.count));
+    pushint(st, def->flags & ~JANET_FUNCDEF_FLAG_SHAREDSOURCEMAP);
     pushint(st, def->slotcount);
     pushint(st, def->arity);
     pushint(st, def->min_arity);
@@ -403,9 +602,44 @@ static void marshal_one_abstract(MarshalState *st, Janet x, int flags) {
     }
 }
 
+/*
+ * Static strings
+ *
+ * With JANET_MARSHAL_MAPPED, longer strings, symbols and keywords are written
+ * as LB_STATIC_STRING, the lead byte of their type, their length, the size of
+ * a string header, padding, a preformatted string header, the bytes, and a
+ * trailing 0. The header is aligned to JANET_MARSHAL_ALIGN bytes from the
+ * start of the message, so that when a message is memory mapped the string
+ * can be used in place instead of being copied onto the heap.
+ */
+
+#define JANET_MARSHAL_ALIGN 8
+#define JANET_MARSHAL_STATIC_MIN 32
+
+static void marshal_static_string(MarshalState *st, uint8_t lb, const uint8_t *str) {
+    int32_t length = janet_string_length(str);
+    JanetStringHead head;
+    memset(&head, 0, sizeof(head));
+    head.gc.flags = JANET_MEM_STATIC | (lb == LB_STRING ? JANET_MEMORY_STRING : JANET_MEMORY_SYMBOL);
+    head.length = length;
+    /* Strings are hashed lazily, but symbols are interned by their hash */
+    head.hash = (lb == LB_STRING) ? 0 : janet_string_hash(str);
+    pushbyte(st, LB_STATIC_STRING);
+    pushbyte(st, lb);
+    pushint(st, length);
+    pushint(st, (int32_t) offsetof(JanetStringHead, data));
+    while ((st->offset + st->buf->count) & (JANET_MARSHAL_ALIGN - 1))
+        pushbyte(st, 0);
+    pushbytes(st, (const uint8_t *) &head, (int32_t) offsetof(JanetStringHead, data));
+    pushbytes(st, str, length + 1);
+}
+
 /* The main body of the marshaling function. Is the main
  * entry point for the mutually recursive functions. */
 static void marshal_one(MarshalState *st, Janet x, int flags) {
+    if (st->file && st->buf->count >= JANET_MARSHAL_FLUSH_SIZE) {
+        marshal_flush(st);
+    }
     MARSH_STACKCHECK;
     JanetType type = janet_type(x);
 
@@ -492,6 +726,10 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
             uint8_t lb = (type == JANET_STRING) ? LB_STRING :
                          (type == JANET_SYMBOL) ? LB_SYMBOL :
                          LB_KEYWORD;
+            if ((flags & JANET_MARSHAL_MAPPED) && length >= JANET_MARSHAL_STATIC_MIN) {
+                marshal_static_string(st, lb, str);
+                return;
+            }
             pushbyte(st, lb);
             pushint(st, length);
             pushbytes(st, str, length);
@@ -614,29 +852,91 @@ void janet_marshal(
     JanetTable *rreg,
     int flags) {
     MarshalState st;
-    st.buf = buf;
+    st.buf = (flags & JANET_MARSHAL_COMPRESS) ? janet_buffer(JANET_MARSHAL_BLOCK_SIZE) : buf;
+    st.zbuf = NULL;
+    st.file = NULL;
+    st.nextid = 0;
+    st.offset = -(int64_t) st.buf->count;
+    st.rreg = rreg;
+    st.maybe_cycles = !(flags & JANET_MARSHAL_NO_CYCLES);
+    janet_table_init(&st.seen, 0);
+    janet_table_init(&st.seen_envs, 0);
+    janet_table_init(&st.seen_defs, 0);
+    marshal_one(&st, x, flags);
+    if (flags & JANET_MARSHAL_COMPRESS) {
+        uint8_t *zbuf = janet_smalloc(JANET_MARSHAL_ZBLOCK_SIZE);
+        janet_buffer_push_u8(buf, LB_COMPRESSED);
+        marshal_compress(buf, zbuf, st.buf->data, st.buf->count);
+        janet_buffer_push_u8(buf, 0);
+        janet_sfree(zbuf);
+    }
+    janet_table_deinit(&st.seen);
+    janet_table_deinit(&st.seen_envs);
+    janet_table_deinit(&st.seen_defs);
+}
+
+void janet_marshal_file(
+    FILE *file,
+    Janet x,
+    JanetTable *rreg,
+    int flags) {
+    MarshalState st;
+    st.buf = janet_buffer(JANET_MARSHAL_FLUSH_SIZE);
+    st.zbuf = NULL;
+    st.file = file;
     st.nextid = 0;
-    st.seen_defs = NULL;
-    st.seen_envs = NULL;
+    st.offset = 0;
     st.rreg = rreg;
     st.maybe_cycles = !(flags & JANET_MARSHAL_NO_CYCLES);
     janet_table_init(&st.seen, 0);
+    janet_table_init(&st.seen_envs, 0);
+    janet_table_init(&st.seen_defs, 0);
+    if (flags & JANET_MARSHAL_COMPRESS) {
+        uint8_t lead = LB_COMPRESSED;
+        /* Scratch memory is freed by the gc if marshalling fails */
+        st.zbuf = janet_smalloc(JANET_MARSHAL_ZBLOCK_SIZE);
+        marshal_write(&st, &lead, 1);
+    }
     marshal_one(&st, x, flags);
+    marshal_flush(&st);
+    if (st.zbuf) {
+        uint8_t terminator = 0;
+        marshal_write(&st, &terminator, 1);
+        janet_sfree(st.zbuf);
+    }
     janet_table_deinit(&st.seen);
-    janet_v_free(st.seen_envs);
-    janet_v_free(st.seen_defs);
+    janet_table_deinit(&st.seen_envs);
+    janet_table_deinit(&st.seen_defs);
 }
 
+/* A source map decoded from the core image */
+typedef struct {
+    JanetSourceMapping *sourcemap;
+    int32_t bytecode_length;
+    int32_t size; /* Size of the encoded source map in the image */
+} JanetSharedSourceMap;
+
 typedef struct {
     jmp_buf err;
     Janet *lookup;
     JanetTable *reg;
     JanetFuncEnv **lookup_envs;
     JanetFuncDef **lookup_defs;
+    JanetSharedSourceMap *shared_maps;
+    JanetSharedSourceMap *record_maps;
+    int32_t shared_maps_count;
+    const uint8_t ***mapped; /* Strings used in place, or NULL if not mapped */
     const uint8_t *start;
     const uint8_t *end;
 } UnmarshalState;
 
+#ifdef JANET_EV
+/* Source maps of the core image are the same in every VM, so once the first
+ * VM has loaded the core image, VMs created later (such as the ones created by
+ * ev/thread) share its decoded source maps. The first element holds the count. */
+static JanetSharedSourceMap *janet_shared_sourcemaps = NULL;
+#endif
+
 #define MARSH_EOS(st, data) do { \
     if ((data) >= (st)->end) janet_panic("unexpected end of source");\
 } while (0)
@@ -812,6 +1112,7 @@ static const uint8_t *unmarshal_one_def(
         /* Initialize with values that will not break garbage collection
          * if unmarshalling fails. */
         JanetFuncDef *def = janet_gcalloc(JANET_MEMORY_FUNCDEF, sizeof(JanetFuncDef));
+        int32_t def_index = janet_v_count(st->lookup_defs);
         def->environments_length = 0;
         def->defs_length = 0;
         def->constants_length = 0;
@@ -833,7 +1134,7 @@ static const uint8_t *unmarshal_one_def(
         int32_t defs_length = 0;
 
         /* Read flags and other fixed values */
-        def->flags = readint(st, &data);
+        def->flags = readint(st, &data) & ~JANET_FUNCDEF_FLAG_SHAREDSOURCEMAP;
         def->slotcount = readnat(st, &data);
         def->arity = readnat(st, &data);
         def->min_arity = readnat(st, &data);
@@ -911,7 +1212,16 @@ static const uint8_t *unmarshal_one_def(
         def->defs_length = defs_length;
 
         /* Unmarshal source maps if needed */
-        if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
+        if ((def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) &&
+                def_index < st->shared_maps_count &&
+                st->shared_maps[def_index].bytecode_length == bytecode_length) {
+            JanetSharedSourceMap *shared = st->shared_maps + def_index;
+            MARSH_EOS(st, data + shared->size - 1);
+            def->sourcemap = shared->sourcemap;
+            def->flags |= JANET_FUNCDEF_FLAG_SHAREDSOURCEMAP;
+            data += shared->size;
+        } else if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
+            const uint8_t *sourcemap_start = data;
             int32_t current = 0;
             def->sourcemap = janet_malloc(sizeof(JanetSourceMapping) * (size_t) bytecode_length);
             if (!def->sourcemap) {
@@ -922,6 +1232,17 @@ static const uint8_t *unmarshal_one_def(
                 def->sourcemap[i].line = current;
                 def->sourcemap[i].column = readint(st, &data);
             }
+            if (NULL != st->record_maps) {
+                JanetSharedSourceMap map;
+                map.sourcemap = def->sourcemap;
+                map.bytecode_length = bytecode_length;
+                map.size = (int32_t)(data - sourcemap_start);
+                while (janet_v_count(st->record_maps) <= def_index + 1) {
+                    JanetSharedSourceMap empty = {NULL, -1, 0};
+                    janet_v_push(st->record_maps, empty);
+                }
+                st->record_maps[def_index + 1] = map;
+            }
         } else {
             def->sourcemap = NULL;
         }
@@ -937,7 +1258,7 @@ static const uint8_t *unmarshal_one_def(
         }
 
         /* Validate */
-        if (janet_verify(def))
+        if (!(flags & JANET_MARSHAL_NO_VERIFY) && janet_verify(def))
             janet_panic("funcdef has invalid bytecode");
 
         /* Set def */
@@ -1257,6 +1578,45 @@ static const uint8_t *unmarshal_one(
             janet_v_push(st->lookup, *out);
             return data + len;
         }
+        case LB_STATIC_STRING: {
+            MARSH_EOS(st, data + 1);
+            uint8_t kind = data[1];
+            if (kind != LB_STRING && kind != LB_SYMBOL && kind != LB_KEYWORD) {
+                janet_panicf("invalid static string at index %d", (int)(data - st->start));
+            }
+            data += 2;
+            int32_t len = readnat(st, &data);
+            int32_t headlen = readnat(st, &data);
+            while ((data - st->start) & (JANET_MARSHAL_ALIGN - 1)) data++;
+            MARSH_EOS(st, data + headlen + len);
+            const uint8_t *bytes = data + headlen;
+            const uint8_t *str = NULL;
+            /* Use the string in place if the message outlives the VM and
+             * the header was written for this platform. */
+            if (NULL != st->mapped &&
+                    headlen == (int32_t) offsetof(JanetStringHead, data) &&
+                    !((uintptr_t) data & (JANET_MARSHAL_ALIGN - 1)) &&
+                    bytes[len] == 0) {
+                const JanetStringHead *head = (const JanetStringHead *) data;
+                int32_t memtype = (kind == LB_STRING) ? JANET_MEMORY_STRING : JANET_MEMORY_SYMBOL;
+                int32_t hash = (kind == LB_STRING) ? 0 : janet_string_calchash(bytes, len);
+                if (head->gc.flags == (JANET_MEM_STATIC | memtype) &&
+                        head->length == len &&
+                        head->hash == hash) {
+                    str = (kind == LB_STRING) ? bytes : janet_symbol_static(bytes);
+                    if (str == bytes) janet_v_push(*st->mapped, str);
+                }
+            }
+            if (kind == LB_STRING) {
+                *out = janet_wrap_string(str ? str : janet_string(bytes, len));
+            } else if (kind == LB_SYMBOL) {
+                *out = janet_wrap_symbol(str ? str : janet_symbol(bytes, len));
+            } else {
+                *out = janet_wrap_keyword(str ? str : janet_keyword(bytes, len));
+            }
+            janet_v_push(st->lookup, *out);
+            return bytes + len + 1;
+        }
         case LB_FIBER: {
             JanetFiber *fiber;
             data = unmarshal_one_fiber(st, data + 1, &fiber, flags);
@@ -1443,25 +1803,198 @@ static const uint8_t *unmarshal_one(
     }
 }
 
-Janet janet_unmarshal(
+static Janet unmarshal_message(
     const uint8_t *bytes,
     size_t len,
     int flags,
     JanetTable *reg,
-    const uint8_t **next) {
+    const uint8_t **next,
+    const uint8_t ***mapped) {
     UnmarshalState st;
+    const uint8_t *compressed_end = NULL;
+    uint8_t *raw = NULL;
     st.start = bytes;
     st.end = bytes + len;
+    if (len > 0 && bytes[0] == LB_COMPRESSED) {
+        /* Decompress all blocks, then unmarshal the result */
+        const uint8_t *data = bytes + 1;
+        size_t rawlen = 0;
+        for (;;) {
+            int32_t blocklen = readnat(&st, &data);
+            if (blocklen == 0) break;
+            int32_t complen = readnat(&st, &data);
+            if (blocklen > JANET_MARSHAL_BLOCK_SIZE || complen == 0)
+                janet_panic("invalid compressed block");
+            MARSH_EOS(&st, data + complen - 1);
+            raw = janet_srealloc(raw, rawlen + (size_t) blocklen);
+            if (lz_decompress(data, complen, raw + rawlen, blocklen))
+                janet_panic("invalid compressed block");
+            rawlen += (size_t) blocklen;
+            data += complen;
+        }
+        compressed_end = data;
+        /* Decompressed bytes are freed before returning */
+        mapped = NULL;
+        bytes = raw;
+        len = rawlen;
+        st.start = bytes;
+        st.end = bytes + len;
+    }
     st.lookup_defs = NULL;
     st.lookup_envs = NULL;
     st.lookup = NULL;
     st.reg = reg;
+    st.shared_maps = NULL;
+    st.record_maps = NULL;
+    st.shared_maps_count = 0;
+    st.mapped = mapped;
+#ifdef JANET_EV
+    if (flags & JANET_MARSHAL_SHARE_SOURCEMAPS) {
+        JanetSharedSourceMap *shared = janet_atomic_load_ptr((void **) &janet_shared_sourcemaps);
+        if (NULL != shared) {
+            st.shared_maps = shared + 1;
+            st.shared_maps_count = shared->size;
+        } else {
+            JanetSharedSourceMap header = {NULL, 0, 0};
+            janet_v_push(st.record_maps, header);
+        }
+    }
+#endif
     Janet out;
     const uint8_t *nextbytes = unmarshal_one(&st, bytes, &out, flags);
+    if (NULL != compressed_end) {
+        nextbytes = compressed_end;
+        janet_sfree(raw);
+    }
     if (next) *next = nextbytes;
     janet_v_free(st.lookup_defs);
     janet_v_free(st.lookup_envs);
     janet_v_free(st.lookup);
+#ifdef JANET_EV
+    if (NULL != st.record_maps) {
+        /* Copy the source maps decoded by this VM, which still owns them */
+        int32_t count = janet_v_count(st.record_maps);
+        JanetSharedSourceMap *shared = janet_malloc(sizeof(JanetSharedSourceMap) * (size_t) count);
+        if (NULL == shared) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 1; i < count; i++) {
+            JanetSharedSourceMap map = st.record_maps[i];
+            if (NULL != map.sourcemap) {
+                size_t size = sizeof(JanetSourceMapping) * (size_t) map.bytecode_length;
+                map.sourcemap = janet_malloc(size);
+                if (NULL == map.sourcemap) {
+                    JANET_OUT_OF_MEMORY;
+                }
+                safe_memcpy(map.sourcemap, st.record_maps[i].sourcemap, size);
+            }
+            shared[i] = map;
+        }
+        shared[0].sourcemap = NULL;
+        shared[0].bytecode_length = 0;
+        shared[0].size = count - 1;
+        janet_v_free(st.record_maps);
+        if (!janet_atomic_cas_ptr((void **) &janet_shared_sourcemaps, NULL, shared)) {
+            /* Another thread published first */
+            for (int32_t i = 1; i < count; i++) janet_free(shared[i].sourcemap);
+            janet_free(shared);
+        }
+    }
+#endif
+    return out;
+}
+
+Janet janet_unmarshal(
+    const uint8_t *bytes,
+    size_t len,
+    int flags,
+    JanetTable *reg,
+    const uint8_t **next) {
+    /* Strings are only used in place by janet_unmarshal_mapped, which knows
+     * the bytes outlive them */
+    return unmarshal_message(bytes, len, flags & ~JANET_MARSHAL_MAPPED, reg, next, NULL);
+}
+
+static void unmap_file(const uint8_t *bytes, size_t len) {
+#ifdef JANET_WINDOWS
+    (void) len;
+    UnmapViewOfFile(bytes);
+#else
+    munmap((void *) bytes, len);
+#endif
+}
+
+Janet janet_unmarshal_mapped(const char *path, int flags, JanetTable *reg) {
+    const uint8_t *bytes;
+    size_t len;
+#ifdef JANET_WINDOWS
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == file) {
+        janet_panicf("failed to open file %s", path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        janet_panicf("failed to map file %s", path);
+    }
+    len = (size_t) size.QuadPart;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (NULL == mapping) {
+        janet_panicf("failed to map file %s", path);
+    }
+    bytes = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (NULL == bytes) {
+        janet_panicf("failed to map file %s", path);
+    }
+#else
+    int fd;
+    struct stat sb;
+    RETRY_EINTR(fd, open(path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        janet_panicf("failed to open file %s: %s", path, strerror(errno));
+    }
+    if (fstat(fd, &sb) || sb.st_size == 0) {
+        close(fd);
+        janet_panicf("failed to map file %s", path);
+    }
+    len = (size_t) sb.st_size;
+    void *mem = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mem) {
+        janet_panicf("failed to map file %s: %s", path, strerror(errno));
+    }
+    bytes = mem;
+#endif
+    const uint8_t **mapped = NULL;
+    Janet out = janet_wrap_nil();
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (JANET_SIGNAL_OK == signal) {
+        out = unmarshal_message(bytes, len, flags & ~JANET_MARSHAL_MAPPED, reg, NULL, &mapped);
+    }
+    janet_restore(&tstate);
+    if (JANET_SIGNAL_OK != signal) {
+        /* Nothing read so far is reachable, but symbols interned from the
+         * mapping must leave the symbol cache before it is released. */
+        for (int32_t i = 0; i < janet_v_count(mapped); i++) {
+            const JanetStringHead *head = janet_string_head(mapped[i]);
+            if ((head->gc.flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_SYMBOL) {
+                janet_symbol_deinit(mapped[i]);
+            }
+        }
+        janet_v_free(mapped);
+        unmap_file(bytes, len);
+        janet_panicv(tstate.payload);
+    }
+    /* Static strings and interned symbols can point into the mapping for as
+     * long as the process runs, so it is only released if none were used. */
+    if (NULL == mapped) {
+        unmap_file(bytes, len);
+    }
+    janet_v_free(mapped);
     return out;
 }
 
@@ -1478,21 +2011,33 @@ JANET_CORE_FN(cfun_env_lookup,
 }
 
 JANET_CORE_FN(cfun_marshal,
-              "(marshal x &opt reverse-lookup buffer no-cycles)",
+              "(marshal x &opt reverse-lookup buffer no-cycles compress mapped)",
               "Marshal a value into a buffer and return the buffer. The buffer "
               "can then later be unmarshalled to reconstruct the initial value. "
               "Optionally, one can pass in a reverse lookup table to not marshal "
               "aliased values that are found in the table. Then a forward "
               "lookup table can be used to recover the original value when "
-              "unmarshalling.") {
-    janet_arity(argc, 1, 4);
-    JanetBuffer *buffer;
+              "unmarshalling. If `buffer` is a file, the marshalled bytes are written "
+              "to the file in chunks as they are produced, and the file is returned. "
+              "If `compress` is truthy, the output is compressed. `unmarshal` detects "
+              "compressed input automatically. If `mapped` is truthy, longer strings, "
+              "symbols and keywords are laid out so that `unmarshal-mapped` can use them "
+              "in place.") {
+    janet_arity(argc, 1, 6);
+    JanetBuffer *buffer = NULL;
+    FILE *file = NULL;
     JanetTable *rreg = NULL;
     uint32_t flags = 0;
-    if (argc > 1) {
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
         rreg = janet_gettable(argv, 1);
     }
-    if (argc > 2) {
+    if (argc > 2 && janet_checkfile(argv[2])) {
+        int32_t fflags;
+        file = janet_getfile(argv, 2, &fflags);
+        if (fflags & JANET_FILE_CLOSED) janet_panic("file is closed");
+        if (!(fflags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE)))
+            janet_panic("file is not writeable");
+    } else if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) {
         buffer = janet_getbuffer(argv, 2);
     } else {
         buffer = janet_buffer(10);
@@ -1500,6 +2045,16 @@ JANET_CORE_FN(cfun_marshal,
     if (argc > 3 && janet_truthy(argv[3])) {
         flags |= JANET_MARSHAL_NO_CYCLES;
     }
+    if (argc > 4 && janet_truthy(argv[4])) {
+        flags |= JANET_MARSHAL_COMPRESS;
+    }
+    if (argc > 5 && janet_truthy(argv[5])) {
+        flags |= JANET_MARSHAL_MAPPED;
+    }
+    if (NULL != file) {
+        janet_marshal_file(file, argv[0], rreg, flags);
+        return argv[2];
+    }
     janet_marshal(buffer, argv[0], rreg, flags);
     return janet_wrap_buffer(buffer);
 }
@@ -1518,11 +2073,30 @@ JANET_CORE_FN(cfun_unmarshal,
     return janet_unmarshal(view.bytes, (size_t) view.len, 0, reg, NULL);
 }
 
+JANET_CORE_FN(cfun_unmarshal_mapped,
+              "(unmarshal-mapped path &opt lookup)",
+              "Unmarshal a value from a file by memory mapping it. Strings, symbols and "
+              "keywords written by `marshal` with `mapped` set point directly into the "
+              "mapping instead of being copied, and the mapped pages are shared between "
+              "processes. If any do, the file stays mapped until the process exits, and "
+              "must not be modified while it is mapped. Strings used in place cannot "
+              "store their hash in the mapping, so they are hashed again each time they "
+              "are used as a table or struct key. Returns the value unmarshalled from the file.") {
+    janet_arity(argc, 1, 2);
+    const char *path = janet_getcstring(argv, 0);
+    JanetTable *reg = NULL;
+    if (argc > 1) {
+        reg = janet_gettable(argv, 1);
+    }
+    return janet_unmarshal_mapped(path, 0, reg);
+}
+
 /* Module entry point */
 void janet_lib_marsh(JanetTable *env) {
     JanetRegExt marsh_cfuns[] = {
         JANET_CORE_REG("marshal", cfun_marshal),
         JANET_CORE_REG("unmarshal", cfun_unmarshal),
+        JANET_CORE_REG("unmarshal-mapped", cfun_unmarshal_mapped),
         JANET_CORE_REG("env-lookup", cfun_env_lookup),
         JANET_REG_END
     };
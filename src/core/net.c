@@ -826,8 +826,13 @@ JANET_CORE_FN(cfun_stream_write,
         janet_ev_send_buffer(stream, janet_getbuffer(argv, 1), MSG_NOSIGNAL);
     } else {
         JanetByteView bytes = janet_getbytes(argv, 1);
+        /* Abstract byte sequences, such as string views, are copied into a
+         * string, which is what the pending write keeps alive */
+        JanetString str = janet_checktype(argv[1], JANET_ABSTRACT)
+                          ? janet_string(bytes.bytes, bytes.len)
+                          : bytes.bytes;
         if (to != INFINITY) janet_addtimeout(to);
-        janet_ev_send_string(stream, bytes.bytes, MSG_NOSIGNAL);
+        janet_ev_send_string(stream, str, MSG_NOSIGNAL);
     }
     janet_await();
 }
@@ -847,8 +852,13 @@ JANET_CORE_FN(cfun_stream_send_to,
         janet_ev_sendto_buffer(stream, janet_getbuffer(argv, 2), dest, MSG_NOSIGNAL);
     } else {
         JanetByteView bytes = janet_getbytes(argv, 2);
+        /* Abstract byte sequences, such as string views, are copied into a
+         * string, which is what the pending write keeps alive */
+        JanetString str = janet_checktype(argv[2], JANET_ABSTRACT)
+                          ? janet_string(bytes.bytes, bytes.len)
+                          : bytes.bytes;
         if (to != INFINITY) janet_addtimeout(to);
-        janet_ev_sendto_string(stream, bytes.bytes, dest, MSG_NOSIGNAL);
+        janet_ev_sendto_string(stream, str, dest, MSG_NOSIGNAL);
     }
     janet_await();
 }
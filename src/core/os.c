@@ -209,47 +209,48 @@ JANET_CORE_FN(os_exit,
     return janet_wrap_nil();
 }
 
-JANET_CORE_FN(os_cpu_count,
-              "(os/cpu-count &opt dflt)",
-              "Get an approximate number of CPUs available on for this process to use. If "
-              "unable to get an approximation, will return a default value dflt.") {
-    janet_arity(argc, 0, 1);
-    Janet dflt = argc > 0 ? argv[0] : janet_wrap_nil();
+/* Get an approximate number of CPUs available to this process, or -1 if unknown */
+int32_t janet_cpu_count(void) {
 #ifdef JANET_WINDOWS
-    (void) dflt;
     SYSTEM_INFO info;
     GetSystemInfo(&info);
-    return janet_wrap_integer(info.dwNumberOfProcessors);
+    return (int32_t) info.dwNumberOfProcessors;
 #elif defined(JANET_LINUX)
-    (void) dflt;
     cpu_set_t cs;
     CPU_ZERO(&cs);
     sched_getaffinity(0, sizeof(cs), &cs);
-    int count = CPU_COUNT(&cs);
-    return janet_wrap_integer(count);
+    return CPU_COUNT(&cs);
 #elif defined(JANET_BSD) && defined(HW_NCPUONLINE)
-    (void) dflt;
     const int name[2] = {CTL_HW, HW_NCPUONLINE};
     int result = 0;
     size_t len = sizeof(int);
     if (-1 == sysctl(name, 2, &result, &len, NULL, 0)) {
-        return dflt;
+        return -1;
     }
-    return janet_wrap_integer(result);
+    return result;
 #elif defined(JANET_BSD) && defined(HW_NCPU)
-    (void) dflt;
     const int name[2] = {CTL_HW, HW_NCPU};
     int result = 0;
     size_t len = sizeof(int);
     if (-1 == sysctl(name, 2, &result, &len, NULL, 0)) {
-        return dflt;
+        return -1;
     }
-    return janet_wrap_integer(result);
+    return result;
 #else
-    return dflt;
+    return -1;
 #endif
 }
 
+JANET_CORE_FN(os_cpu_count,
+              "(os/cpu-count &opt dflt)",
+              "Get an approximate number of CPUs available on for this process to use. If "
+              "unable to get an approximation, will return a default value dflt.") {
+    janet_arity(argc, 0, 1);
+    Janet dflt = argc > 0 ? argv[0] : janet_wrap_nil();
+    int32_t count = janet_cpu_count();
+    return count < 0 ? dflt : janet_wrap_integer(count);
+}
+
 #ifndef JANET_REDUCED_OS
 
 #ifndef JANET_NO_PROCESSES
@@ -56,19 +56,25 @@ int janet_is_symbol_char(uint8_t c) {
     return symchars[c >> 5] & ((uint32_t)1 << (c & 0x1F));
 }
 
-/* Validate some utf8. Useful for identifiers. Only validates
- * the encoding, does not check for valid code points (they
- * are less well defined than the encoding). */
-int janet_valid_utf8(const uint8_t *str, int32_t len) {
+/* Validate some utf8. Runs of ascii are skipped with janet_ascii_prefix.
+ * If strict is not set, only validates the encoding and does not check
+ * for valid code points (they are less well defined than the encoding).
+ * Strict validation follows RFC 3629 and also rejects surrogates and code
+ * points past U+10FFFF. */
+static int valid_utf8(const uint8_t *str, int32_t len, int strict) {
     int32_t i = 0;
     int32_t j;
     while (i < len) {
         int32_t nexti;
         uint8_t c = str[i];
 
+        if (c < 0x80) {
+            i += janet_ascii_prefix(str + i, len - i);
+            continue;
+        }
+
         /* Check the number of bytes in code point */
-        if (c < 0x80) nexti = i + 1;
-        else if ((c >> 5) == 0x06) nexti = i + 2;
+        if ((c >> 5) == 0x06) nexti = i + 2;
         else if ((c >> 4) == 0x0E) nexti = i + 3;
         else if ((c >> 3) == 0x1E) nexti = i + 4;
         /* Don't allow 5 or 6 byte code points */
@@ -87,11 +93,27 @@ int janet_valid_utf8(const uint8_t *str, int32_t len) {
         if ((str[i] == 0xE0) && str[i + 1] < 0xA0) return 0;
         if ((str[i] == 0xF0) && str[i + 1] < 0x90) return 0;
 
+        /* Check for surrogates and code points that are too large */
+        if (strict) {
+            if ((str[i] == 0xED) && str[i + 1] >= 0xA0) return 0;
+            if ((str[i] == 0xF4) && str[i + 1] >= 0x90) return 0;
+            if (str[i] > 0xF4) return 0;
+        }
+
         i = nexti;
     }
     return 1;
 }
 
+/* Useful for identifiers. */
+int janet_valid_utf8(const uint8_t *str, int32_t len) {
+    return valid_utf8(str, len, 0);
+}
+
+int janet_valid_utf8_strict(const uint8_t *str, int32_t len) {
+    return valid_utf8(str, len, 1);
+}
+
 /* Get hex digit from a letter */
 static int to_hex(uint8_t c) {
     if (c >= '0' && c <= '9') {
@@ -27,6 +27,24 @@
 #include "util.h"
 #include "vector.h"
 #include "util.h"
+#include "gc.h"
+#include "state.h"
+#endif
+
+#ifdef JANET_EV
+#ifdef JANET_WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(JANET_WINDOWS) && !defined(JANET_NO_PEG_NATIVE)
+#define JANET_PEG_NATIVE
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 #endif
 
 #ifdef JANET_PEG
@@ -35,12 +53,29 @@
  * Runtime
  */
 
+typedef struct PegMemo PegMemo;
+
+/* Machine code for the rules of a peg */
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    uint32_t entries[]; /* Offset of the function for each rule in code, or 0 */
+} PegNative;
+
+typedef const uint8_t *(*PegNativeFn)(const uint8_t *text, const uint8_t *end,
+                                      int64_t depth, const uint8_t *start);
+
 /* Hold captured patterns and match state */
 typedef struct {
     const uint8_t *text_start;
     const uint8_t *text_end;
     const uint32_t *bytecode;
+    const uint32_t *first;
     const Janet *constants;
+    PegMemo *memo;
+    const uint32_t *memo_slots;
+    const uint32_t *memo_skip;
+    const PegNative *native;
     JanetArray *captures;
     JanetBuffer *scratch;
     JanetBuffer *tags;
@@ -51,6 +86,8 @@ typedef struct {
     int32_t depth;
     int32_t linemaplen;
     int32_t has_backref;
+    int32_t hit_end; /* Set when a result depended on where the text ends */
+    int32_t partial; /* Set when more text may follow text_end, as in a peg stream */
     enum {
         PEG_MODE_NORMAL,
         PEG_MODE_ACCUMULATE
@@ -66,6 +103,41 @@ typedef struct {
     int32_t scratch;
 } CapState;
 
+/* Kinds of annotation in JanetPeg.first, made by the first set analysis */
+#define PEG_SCAN_BYTE 1
+#define PEG_SCAN_SET 2
+#define PEG_CHOICE_DISPATCH 3
+#define PEG_CHOICE_FILTER 4
+
+/* Get the annotation for an instruction, or NULL */
+static const uint32_t *peg_first(PegState *s, const uint32_t *rule) {
+    if (NULL == s->first) return NULL;
+    uint32_t offset = s->first[rule - s->bytecode];
+    return offset ? s->first + offset : NULL;
+}
+
+/* Check if an alternative of a choice can match at text */
+static int peg_first_check(PegState *s, const uint32_t *alt, const uint8_t *text) {
+    if (alt[0]) return 1;
+    if (text >= s->text_end) {
+        s->hit_end = 1;
+        return 0;
+    }
+    return (alt[1 + (text[0] >> 5)] >> (text[0] & 0x1F)) & 1;
+}
+
+/* Find the next position at or after text where a scan annotation can match */
+static const uint8_t *peg_scan(const uint32_t *scan, const uint8_t *text, const uint8_t *end) {
+    if (scan[0] == PEG_SCAN_BYTE) {
+        return memchr(text, (int) scan[1], end - text);
+    }
+    for (; text < end; text++) {
+        if (scan[1 + (text[0] >> 5)] & ((uint32_t) 1 << (text[0] & 0x1F)))
+            return text;
+    }
+    return NULL;
+}
+
 /* Save the current capture state */
 static CapState cap_save(PegState *s) {
     CapState cs;
@@ -113,14 +185,13 @@ typedef struct {
 static LineCol get_linecol_from_position(PegState *s, int32_t position) {
     /* Generate if not made yet */
     if (s->linemaplen < 0) {
-        int32_t newline_count = 0;
-        for (const uint8_t *c = s->text_start; c < s->text_end; c++) {
-            if (*c == '\n') newline_count++;
-        }
+        int32_t len = (int32_t)(s->text_end - s->text_start);
+        int32_t newline_count = janet_bytes_count(s->text_start, len, '\n');
         int32_t *mem = janet_smalloc(sizeof(int32_t) * newline_count);
         size_t index = 0;
-        for (const uint8_t *c = s->text_start; c < s->text_end; c++) {
-            if (*c == '\n') mem[index++] = (int32_t)(c - s->text_start);
+        const uint8_t *c = s->text_start;
+        while ((c = memchr(c, '\n', (size_t)(s->text_end - c)))) {
+            mem[index++] = (int32_t)(c++ - s->text_start);
         }
         s->linemaplen = newline_count;
         s->linemap = mem;
@@ -161,12 +232,163 @@ static int64_t peg_convert_u64_s64(uint64_t from, int width) {
     return ((int64_t)(from << shift)) >> shift;
 }
 
+/*
+ * Memoization
+ */
+
+/* A memoized result of a rule at a position. Captures and accumulated
+ * text made by the rule are kept in PegMemo so they can be replayed. */
+typedef struct {
+    int32_t pos; /* -1 for an empty entry */
+    uint32_t key; /* Memo slot of the rule and capture mode */
+    int32_t end; /* -1 if the rule did not match */
+    int32_t cap;
+    int32_t ncap;
+    int32_t scratch;
+    int32_t nscratch;
+} PegMemoEntry;
+
+struct PegMemo {
+    JanetPeg *peg;
+    PegMemoEntry *entries;
+    int32_t capacity;
+    int32_t count;
+    JanetArray *captures;
+    JanetBuffer *scratch;
+};
+
+/* Make memoization state for a peg, or NULL if it does not memoize */
+static PegMemo *peg_memo_init(JanetPeg *peg) {
+    if (NULL == peg->memo || peg->has_backref) return NULL;
+    PegMemo *memo = janet_smalloc(sizeof(PegMemo));
+    memo->peg = peg;
+    memo->entries = NULL;
+    memo->capacity = 0;
+    memo->count = 0;
+    memo->captures = janet_array(0);
+    memo->scratch = janet_buffer(0);
+    return memo;
+}
+
+static void peg_memo_deinit(PegMemo *memo) {
+    if (NULL == memo) return;
+    janet_sfree(memo->entries);
+    janet_sfree(memo);
+}
+
+/* Memory used by a memo table */
+static size_t peg_memo_size(PegMemo *memo) {
+    return (size_t) memo->capacity * sizeof(PegMemoEntry) +
+           (size_t) memo->captures->count * sizeof(Janet) +
+           (size_t) memo->scratch->count;
+}
+
+static PegMemoEntry *peg_memo_find(PegMemo *memo, uint32_t key, int32_t pos) {
+    uint32_t mask = (uint32_t) memo->capacity - 1;
+    uint32_t h = ((uint32_t) pos * 0x9E3779B1u) ^ (key * 0x85EBCA77u);
+    for (uint32_t i = h & mask; ; i = (i + 1) & mask) {
+        PegMemoEntry *entry = memo->entries + i;
+        if (entry->pos < 0 || (entry->pos == pos && entry->key == key))
+            return entry;
+    }
+}
+
+static void peg_memo_clear(PegMemo *memo, int32_t capacity) {
+    janet_sfree(memo->entries);
+    memo->entries = janet_smalloc(capacity * sizeof(PegMemoEntry));
+    for (int32_t i = 0; i < capacity; i++) memo->entries[i].pos = -1;
+    memo->capacity = capacity;
+    memo->count = 0;
+    memo->captures->count = 0;
+    memo->scratch->count = 0;
+}
+
+/* Make room for one more entry, growing the table or flushing it if
+ * it has outgrown its budget */
+static void peg_memo_reserve(PegMemo *memo) {
+    if (memo->capacity == 0) {
+        peg_memo_clear(memo, 64);
+        return;
+    }
+    if (peg_memo_size(memo) > memo->peg->memo_budget) {
+        memo->peg->memo_flushes++;
+        peg_memo_clear(memo, memo->capacity);
+        return;
+    }
+    if (2 * (memo->count + 1) <= memo->capacity) return;
+    PegMemoEntry *old = memo->entries;
+    int32_t old_capacity = memo->capacity;
+    memo->capacity *= 2;
+    memo->entries = janet_smalloc(memo->capacity * sizeof(PegMemoEntry));
+    for (int32_t i = 0; i < memo->capacity; i++) memo->entries[i].pos = -1;
+    for (int32_t i = 0; i < old_capacity; i++) {
+        if (old[i].pos >= 0) *peg_memo_find(memo, old[i].key, old[i].pos) = old[i];
+    }
+    janet_sfree(old);
+}
+
 /* Prevent stack overflow */
 #define down1(s) do { \
     if (0 == --((s)->depth)) janet_panic("peg/match recursed too deeply"); \
 } while (0)
 #define up1(s) ((s)->depth++)
 
+static const uint8_t *peg_rule(PegState *s, const uint32_t *rule, const uint8_t *text);
+
+/* Look for an earlier result of a memoized rule at the same position.
+ * Returns 1 and sets *out if there is one. */
+static int peg_memo_get(PegState *s, uint32_t slot, const uint8_t *text, const uint8_t **out) {
+    PegMemo *memo = s->memo;
+    uint32_t key = (slot << 1) | (s->mode == PEG_MODE_ACCUMULATE);
+    int32_t pos = (int32_t)(text - s->text_start);
+    if (!memo->capacity) return 0;
+    PegMemoEntry *entry = peg_memo_find(memo, key, pos);
+    if (entry->pos < 0) return 0;
+    memo->peg->memo_hits++;
+    if (entry->end < 0) {
+        *out = NULL;
+        return 1;
+    }
+    for (int32_t i = 0; i < entry->ncap; i++)
+        janet_array_push(s->captures, memo->captures->data[entry->cap + i]);
+    janet_buffer_push_bytes(s->scratch, memo->scratch->data + entry->scratch, entry->nscratch);
+    *out = s->text_start + entry->end;
+    return 1;
+}
+
+/* Match a memoized rule, using an earlier result at the same position if there is one */
+static const uint8_t *peg_rule_memo(PegState *s, const uint32_t *rule, uint32_t slot, const uint8_t *text) {
+    PegMemo *memo = s->memo;
+    uint32_t key = (slot << 1) | (s->mode == PEG_MODE_ACCUMULATE);
+    int32_t pos = (int32_t)(text - s->text_start);
+    const uint8_t *result;
+    if (peg_memo_get(s, slot, text, &result)) return result;
+    memo->peg->memo_misses++;
+    CapState cs = cap_save(s);
+    s->memo_skip = rule;
+    down1(s);
+    result = peg_rule(s, rule, text);
+    up1(s);
+    peg_memo_reserve(memo);
+    PegMemoEntry *entry = peg_memo_find(memo, key, pos);
+    entry->pos = pos;
+    entry->key = key;
+    entry->end = (NULL == result) ? -1 : (int32_t)(result - s->text_start);
+    entry->cap = memo->captures->count;
+    entry->scratch = memo->scratch->count;
+    entry->ncap = 0;
+    entry->nscratch = 0;
+    if (NULL != result) {
+        entry->ncap = s->captures->count - cs.cap;
+        entry->nscratch = s->scratch->count - cs.scratch;
+        for (int32_t i = 0; i < entry->ncap; i++)
+            janet_array_push(memo->captures, s->captures->data[cs.cap + i]);
+        janet_buffer_push_bytes(memo->scratch, s->scratch->data + cs.scratch, entry->nscratch);
+    }
+    memo->count++;
+    return result;
+}
+
 /* Evaluate a peg rule
  * Pre-conditions: s is in a valid state
  * Post-conditions: If there is a match, returns a pointer to the next text.
@@ -178,7 +400,31 @@ static const uint8_t *peg_rule(
     PegState *s,
     const uint32_t *rule,
     const uint8_t *text) {
+    int tail_call = 0;
 tail:
+    if (NULL != s->memo) {
+        uint32_t slot = s->memo_slots[rule - s->bytecode];
+        if (slot) {
+            /* Tail calls reuse stored results, but are not stored themselves
+             * so that they keep running in constant stack space. */
+            if (tail_call) {
+                const uint8_t *result;
+                if (peg_memo_get(s, slot, text, &result)) return result;
+            } else if (s->memo_skip != rule) {
+                return peg_rule_memo(s, rule, slot, text);
+            }
+            s->memo_skip = NULL;
+        }
+    }
+#ifdef JANET_PEG_NATIVE
+    if (NULL != s->native) {
+        uint32_t entry = s->native->entries[rule - s->bytecode];
+        if (entry) {
+            PegNativeFn fn = (PegNativeFn)(s->native->code + entry);
+            return fn(text, s->text_end, s->depth, s->text_start);
+        }
+    }
+#endif
     switch (*rule & 0x1F) {
         default:
             janet_panic("unexpected opcode");
@@ -186,32 +432,50 @@ tail:
 
         case RULE_LITERAL: {
             uint32_t len = rule[1];
-            if (text + len > s->text_end) return NULL;
+            if (text + len > s->text_end) {
+                /* More text could complete the literal */
+                if (!memcmp(text, rule + 2, s->text_end - text)) s->hit_end = 1;
+                return NULL;
+            }
             return memcmp(text, rule + 2, len) ? NULL : text + len;
         }
 
         case RULE_NCHAR: {
             uint32_t n = rule[1];
-            return (text + n > s->text_end) ? NULL : text + n;
+            if (text + n > s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
+            return text + n;
         }
 
         case RULE_NOTNCHAR: {
             uint32_t n = rule[1];
-            return (text + n > s->text_end) ? text : NULL;
+            if (text + n > s->text_end) {
+                s->hit_end = 1;
+                return text;
+            }
+            return NULL;
         }
 
         case RULE_RANGE: {
             uint8_t lo = rule[1] & 0xFF;
             uint8_t hi = (rule[1] >> 16) & 0xFF;
-            return (text < s->text_end &&
-                    text[0] >= lo &&
+            if (text >= s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
+            return (text[0] >= lo &&
                     text[0] <= hi)
                    ? text + 1
                    : NULL;
         }
 
         case RULE_SET: {
-            if (text >= s->text_end) return NULL;
+            if (text >= s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
             uint32_t word = rule[1 + (text[0] >> 5)];
             uint32_t mask = (uint32_t)1 << (text[0] & 0x1F);
             return (word & mask)
@@ -221,7 +485,11 @@ tail:
 
         case RULE_LOOK: {
             text += ((int32_t *)rule)[1];
-            if (text < s->text_start || text > s->text_end) return NULL;
+            if (text < s->text_start) return NULL;
+            if (text > s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
             down1(s);
             const uint8_t *result = peg_rule(s, s->bytecode + rule[2], text);
             up1(s);
@@ -233,9 +501,23 @@ tail:
             uint32_t len = rule[1];
             const uint32_t *args = rule + 2;
             if (len == 0) return NULL;
+            const uint32_t *first = peg_first(s, rule);
+            if (NULL != first && first[0] == PEG_CHOICE_DISPATCH) {
+                /* At most one alternative can match */
+                if (text >= s->text_end) {
+                    s->hit_end = 1;
+                    return NULL;
+                }
+                uint8_t which = ((const uint8_t *)(first + 1))[text[0]];
+                if (which == 0xFF) return NULL;
+                rule = s->bytecode + args[which];
+                tail_call = 1;
+                goto tail;
+            }
             down1(s);
             CapState cs = cap_save(s);
             for (uint32_t i = 0; i < len - 1; i++) {
+                if (NULL != first && !peg_first_check(s, first + 1 + 9 * i, text)) continue;
                 const uint8_t *result = peg_rule(s, s->bytecode + args[i], text);
                 if (result) {
                     up1(s);
@@ -244,7 +526,9 @@ tail:
                 cap_load(s, cs);
             }
             up1(s);
+            if (NULL != first && !peg_first_check(s, first + 1 + 9 * (len - 1), text)) return NULL;
             rule = s->bytecode + args[len - 1];
+            tail_call = 1;
             goto tail;
         }
 
@@ -258,6 +542,7 @@ tail:
             up1(s);
             if (!text) return NULL;
             rule = s->bytecode + args[len - 1];
+            tail_call = 1;
             goto tail;
         }
 
@@ -269,6 +554,7 @@ tail:
             up1(s);
             if (!result) return NULL;
             rule = rule_b;
+            tail_call = 1;
             goto tail;
         }
         case RULE_IFNOT: {
@@ -284,6 +570,7 @@ tail:
                 cap_load(s, cs);
                 up1(s);
                 rule = rule_b;
+                tail_call = 1;
                 goto tail;
             }
         }
@@ -306,10 +593,20 @@ tail:
         case RULE_THRU:
         case RULE_TO: {
             const uint32_t *rule_a = s->bytecode + rule[1];
+            const uint32_t *scan = peg_first(s, rule);
             const uint8_t *next_text = NULL;
             CapState cs = cap_save(s);
             down1(s);
             while (text <= s->text_end) {
+                if (NULL != scan) {
+                    /* Skip to where rule_a can match */
+                    text = peg_scan(scan, text, s->text_end);
+                    if (NULL == text) {
+                        s->hit_end = 1;
+                        text = s->text_end + 1;
+                        break;
+                    }
+                }
                 CapState cs2 = cap_save(s);
                 next_text = peg_rule(s, rule_a, text);
                 if (next_text) {
@@ -435,6 +732,7 @@ tail:
             int oldmode = s->mode;
             if (!tag && oldmode == PEG_MODE_ACCUMULATE) {
                 rule = s->bytecode + rule[1];
+                tail_call = 1;
                 goto tail;
             }
             CapState cs = cap_save(s);
@@ -537,6 +835,9 @@ tail:
             up1(s);
             s->mode = oldmode;
             if (!result) return NULL;
+            /* More input could let an earlier choice match instead, so a
+             * partial match gives up and waits for it rather than raising */
+            if (s->partial && s->hit_end) return NULL;
             if (s->captures->count > old_cap) {
                 /* Throw last capture */
                 janet_panicv(s->captures->data[s->captures->count - 1]);
@@ -558,8 +859,10 @@ tail:
                         return NULL;
                     const uint8_t *bytes = janet_unwrap_string(capture);
                     int32_t len = janet_string_length(bytes);
-                    if (text + len > s->text_end)
+                    if (text + len > s->text_end) {
+                        if (!memcmp(text, bytes, s->text_end - text)) s->hit_end = 1;
                         return NULL;
+                    }
                     return memcmp(text, bytes, len) ? NULL : text + len;
                 }
             }
@@ -603,7 +906,10 @@ tail:
             uint32_t signedness = rule[1] & 0x10;
             uint32_t endianess = rule[1] & 0x20;
             int width = (int)(rule[1] & 0xF);
-            if (text + width > s->text_end) return NULL;
+            if (text + width > s->text_end) {
+                s->hit_end = 1;
+                return NULL;
+            }
             uint64_t accum = 0;
             if (endianess) {
                 /* BE */
@@ -674,12 +980,14 @@ typedef struct {
     JanetTable *grammar;
     JanetTable *default_grammar;
     JanetTable *tags;
+    JanetTable *deps;
     Janet *constants;
     uint32_t *bytecode;
     Janet form;
     int depth;
     uint32_t nexttag;
     int has_backref;
+    int cacheable;
 } Builder;
 
 /* Forward declaration to allow recursion */
@@ -1217,6 +1525,10 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
             if (janet_checktype(nextPeg, JANET_NIL)) {
                 peg_panic(b, "unknown rule");
             }
+            /* Remember the binding so a cached peg can be checked against
+             * later changes to the default grammar */
+            if (NULL == b->deps) b->deps = janet_table(0);
+            janet_table_put(b->deps, peg, nextPeg);
         }
         peg = nextPeg;
         b->form = peg;
@@ -1279,6 +1591,7 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
         }
         case JANET_TABLE: {
             /* Build grammar table */
+            b->cacheable = 0;
             JanetTable *new_grammar = janet_table_clone(janet_unwrap_table(peg));
             new_grammar->proto = grammar;
             b->grammar = grammar = new_grammar;
@@ -1343,6 +1656,1056 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
     return rule;
 }
 
+/*
+ * First set analysis
+ */
+
+/* The first set of a rule is the set of bytes that the rule can start
+ * with. If a rule is tried at a position whose byte is not in its first set
+ * (or at the end of the text), then either it fails without side effects, or it
+ * is nullable and may succeed without advancing. Opaque rules are ones we can
+ * say nothing about, such as lookbehind, or error and cmt rules that would
+ * run on an empty match. */
+#define PEG_FIRST_NULLABLE 0x1
+#define PEG_FIRST_OPAQUE 0x2
+
+/* Give up on grammars that need too many passes to find a fixed point */
+#define PEG_FIRST_MAX_PASSES 64
+
+/* Length of an instruction in validated bytecode */
+static uint32_t peg_rule_len(const uint32_t *rule) {
+    switch (rule[0] & 0x1F) {
+        default:
+            return 2;
+        case RULE_LITERAL:
+            return 2 + ((rule[1] + 3) >> 2);
+        case RULE_SET:
+            return 9;
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            return 2 + rule[1];
+        case RULE_LOOK:
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+        case RULE_ARGUMENT:
+        case RULE_GETTAG:
+        case RULE_CONSTANT:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_CAPTURE:
+        case RULE_UNREF:
+        case RULE_READINT:
+            return 3;
+        case RULE_BETWEEN:
+        case RULE_CAPTURE_NUM:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+            return 4;
+    }
+}
+
+/* Get the instructions that an instruction in validated bytecode refers to.
+ * Returns how many there are and points children at their indices. */
+static uint32_t peg_rule_children(const uint32_t *rule, const uint32_t **children) {
+    switch (rule[0] & 0x1F) {
+        default:
+            return 0;
+        case RULE_LOOK:
+            *children = rule + 2;
+            return 1;
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            *children = rule + 2;
+            return rule[1];
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+            *children = rule + 1;
+            return 2;
+        case RULE_BETWEEN:
+            *children = rule + 3;
+            return 1;
+        case RULE_CAPTURE:
+        case RULE_CAPTURE_NUM:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_UNREF:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_NOT:
+        case RULE_TO:
+        case RULE_THRU:
+            *children = rule + 1;
+            return 1;
+    }
+}
+
+/* Compute the first set of one instruction from the current first sets of its
+ * children. Returns non-zero if anything changed. */
+static int peg_first1(const uint32_t *bytecode, uint32_t at, uint32_t *sets, uint8_t *flags) {
+    const uint32_t *rule = bytecode + at;
+    uint32_t set[8] = {0};
+    int flag = 0;
+#define PEG_FIRST_ALL() memset(set, 0xFF, sizeof(set))
+#define PEG_FIRST_JOIN(r) do { \
+    for (int k = 0; k < 8; k++) set[k] |= sets[8 * (r) + k]; \
+    flag |= flags[(r)] & PEG_FIRST_OPAQUE; \
+} while (0)
+    switch (rule[0] & 0x1F) {
+        default:
+            flag = PEG_FIRST_OPAQUE;
+            break;
+        case RULE_LITERAL:
+            if (rule[1]) {
+                uint8_t c = ((const uint8_t *)(rule + 2))[0];
+                set[c >> 5] |= (uint32_t) 1 << (c & 0x1F);
+            } else {
+                flag = PEG_FIRST_NULLABLE;
+            }
+            break;
+        case RULE_NCHAR:
+            if (rule[1]) {
+                PEG_FIRST_ALL();
+            } else {
+                flag = PEG_FIRST_NULLABLE;
+            }
+            break;
+        case RULE_READINT:
+            if (rule[1] & 0xF) {
+                PEG_FIRST_ALL();
+            } else {
+                flag = PEG_FIRST_NULLABLE;
+            }
+            break;
+        case RULE_RANGE: {
+            uint32_t lo = rule[1] & 0xFF;
+            uint32_t hi = (rule[1] >> 16) & 0xFF;
+            for (uint32_t c = lo; c <= hi; c++)
+                set[c >> 5] |= (uint32_t) 1 << (c & 0x1F);
+            break;
+        }
+        case RULE_SET:
+            memcpy(set, rule + 1, sizeof(set));
+            break;
+        case RULE_NOTNCHAR:
+        case RULE_GETTAG:
+        case RULE_POSITION:
+        case RULE_ARGUMENT:
+        case RULE_CONSTANT:
+        case RULE_LINE:
+        case RULE_COLUMN:
+            flag = PEG_FIRST_NULLABLE;
+            break;
+        case RULE_BACKMATCH:
+            PEG_FIRST_ALL();
+            flag = PEG_FIRST_NULLABLE;
+            break;
+        case RULE_LOOK:
+            if (rule[1]) {
+                flag = PEG_FIRST_OPAQUE;
+            } else {
+                PEG_FIRST_JOIN(rule[2]);
+                flag |= flags[rule[2]];
+            }
+            break;
+        case RULE_CHOICE:
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                PEG_FIRST_JOIN(rule[2 + i]);
+                flag |= flags[rule[2 + i]];
+            }
+            break;
+        case RULE_SEQUENCE:
+            flag = PEG_FIRST_NULLABLE;
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                PEG_FIRST_JOIN(rule[2 + i]);
+                if (!(flags[rule[2 + i]] & PEG_FIRST_NULLABLE)) {
+                    flag &= ~PEG_FIRST_NULLABLE;
+                    break;
+                }
+            }
+            break;
+        case RULE_IF:
+            PEG_FIRST_JOIN(rule[1]);
+            PEG_FIRST_JOIN(rule[2]);
+            flag |= flags[rule[1]] & flags[rule[2]] & PEG_FIRST_NULLABLE;
+            break;
+        case RULE_IFNOT:
+            PEG_FIRST_JOIN(rule[1]);
+            PEG_FIRST_JOIN(rule[2]);
+            flag |= flags[rule[2]] & PEG_FIRST_NULLABLE;
+            break;
+        case RULE_NOT:
+            PEG_FIRST_JOIN(rule[1]);
+            flag |= PEG_FIRST_NULLABLE;
+            break;
+        case RULE_LENPREFIX:
+            PEG_FIRST_JOIN(rule[1]);
+            PEG_FIRST_JOIN(rule[2]);
+            flag |= PEG_FIRST_NULLABLE;
+            break;
+        case RULE_BETWEEN:
+            PEG_FIRST_JOIN(rule[3]);
+            flag |= flags[rule[3]];
+            if (rule[1] == 0) flag |= PEG_FIRST_NULLABLE;
+            break;
+        case RULE_TO:
+        case RULE_THRU:
+            PEG_FIRST_ALL();
+            flag = (flags[rule[1]] & PEG_FIRST_OPAQUE) | PEG_FIRST_NULLABLE;
+            break;
+        case RULE_CAPTURE:
+        case RULE_CAPTURE_NUM:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_DROP:
+        case RULE_UNREF:
+            PEG_FIRST_JOIN(rule[1]);
+            flag |= flags[rule[1]];
+            break;
+        case RULE_ERROR:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+            /* These have side effects when their rule matches */
+            PEG_FIRST_JOIN(rule[1]);
+            flag |= flags[rule[1]];
+            if (flag & PEG_FIRST_NULLABLE) flag |= PEG_FIRST_OPAQUE;
+            break;
+    }
+    /* Opaque rules can start with anything */
+    if (flag & PEG_FIRST_OPAQUE) {
+        PEG_FIRST_ALL();
+        flag = PEG_FIRST_OPAQUE | PEG_FIRST_NULLABLE;
+    }
+#undef PEG_FIRST_ALL
+#undef PEG_FIRST_JOIN
+    int changed = flag != flags[at];
+    flags[at] = (uint8_t) flag;
+    for (int k = 0; k < 8; k++) {
+        changed = changed || sets[8 * at + k] != set[k];
+        sets[8 * at + k] = set[k];
+    }
+    return changed;
+}
+
+/* Push an annotation for scanning to the next byte that a rule can start with */
+static uint32_t peg_push_scan(uint32_t **aux, const uint32_t *set, uint8_t flag) {
+    if (flag) return 0;
+    uint32_t at = (uint32_t) janet_v_count(*aux);
+    int count = 0;
+    uint32_t last = 0;
+    for (uint32_t c = 0; c < 256; c++) {
+        if (set[c >> 5] & ((uint32_t) 1 << (c & 0x1F))) {
+            count++;
+            last = c;
+        }
+    }
+    if (count == 256) return 0;
+    if (count == 1) {
+        janet_v_push(*aux, PEG_SCAN_BYTE);
+        janet_v_push(*aux, last);
+    } else {
+        janet_v_push(*aux, PEG_SCAN_SET);
+        for (int k = 0; k < 8; k++) janet_v_push(*aux, set[k]);
+    }
+    return at;
+}
+
+/* Push an annotation for a choice. If no alternative can match the empty string
+ * and their first sets are disjoint, we can jump straight to the only alternative
+ * that can match. Otherwise, we can still skip alternatives that cannot match. */
+static uint32_t peg_push_choice(uint32_t **aux, const uint32_t *rule, const uint32_t *sets, const uint8_t *flags) {
+    uint32_t len = rule[1];
+    uint32_t at = (uint32_t) janet_v_count(*aux);
+    if (len < 2) return 0;
+    int disjoint = len < 0xFF;
+    int useful = 0;
+    uint8_t table[256];
+    memset(table, 0xFF, sizeof(table));
+    for (uint32_t i = 0; i < len; i++) {
+        const uint32_t *set = sets + 8 * rule[2 + i];
+        if (flags[rule[2 + i]]) {
+            disjoint = 0;
+            continue;
+        }
+        useful = 1;
+        for (uint32_t c = 0; disjoint && c < 256; c++) {
+            if (set[c >> 5] & ((uint32_t) 1 << (c & 0x1F))) {
+                if (table[c] != 0xFF) disjoint = 0;
+                table[c] = (uint8_t) i;
+            }
+        }
+    }
+    if (!useful) return 0;
+    if (disjoint) {
+        janet_v_push(*aux, PEG_CHOICE_DISPATCH);
+        for (int k = 0; k < 64; k++) {
+            uint32_t word;
+            memcpy(&word, table + 4 * k, sizeof(word));
+            janet_v_push(*aux, word);
+        }
+    } else {
+        janet_v_push(*aux, PEG_CHOICE_FILTER);
+        for (uint32_t i = 0; i < len; i++) {
+            const uint32_t *set = sets + 8 * rule[2 + i];
+            int always = flags[rule[2 + i]] != 0;
+            janet_v_push(*aux, (uint32_t) always);
+            for (int k = 0; k < 8; k++) janet_v_push(*aux, always ? 0xFFFFFFFFu : set[k]);
+        }
+    }
+    return at;
+}
+
+/* Analyze validated bytecode. Returns a malloced table with one word per
+ * bytecode word giving the offset of the annotation for that instruction (or 0),
+ * one word for the annotation of the whole peg, then the annotations. Returns
+ * NULL if there is nothing to annotate. */
+static uint32_t *peg_first_sets(const uint32_t *bytecode, uint32_t blen) {
+    if (blen == 0) return NULL;
+    uint32_t *sets = janet_calloc(blen, 8 * sizeof(uint32_t));
+    uint8_t *flags = janet_calloc(blen, 1);
+    uint32_t *starts = janet_malloc(blen * sizeof(uint32_t));
+    if (NULL == sets || NULL == flags || NULL == starts) {
+        JANET_OUT_OF_MEMORY;
+    }
+    uint32_t nstarts = 0;
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i))
+        starts[nstarts++] = i;
+
+    /* Iterate to a fixed point. Rules usually refer to later rules, so go backwards. */
+    int changed = 1;
+    int passes = 0;
+    while (changed && passes++ < PEG_FIRST_MAX_PASSES) {
+        changed = 0;
+        for (uint32_t i = nstarts; i > 0; i--)
+            changed |= peg_first1(bytecode, starts[i - 1], sets, flags);
+    }
+
+    uint32_t *aux = NULL;
+    uint32_t *result = NULL;
+    if (!changed) {
+        for (uint32_t i = 0; i < blen + 1; i++) janet_v_push(aux, 0);
+        uint32_t root = peg_push_scan(&aux, sets, flags[0]);
+        int any = root != 0;
+        aux[blen] = root;
+        for (uint32_t i = 0; i < nstarts; i++) {
+            const uint32_t *rule = bytecode + starts[i];
+            uint32_t offset = 0;
+            switch (rule[0] & 0x1F) {
+                default:
+                    break;
+                case RULE_CHOICE:
+                    offset = peg_push_choice(&aux, rule, sets, flags);
+                    break;
+                case RULE_TO:
+                case RULE_THRU:
+                    offset = peg_push_scan(&aux, sets + 8 * rule[1], flags[rule[1]]);
+                    break;
+            }
+            aux[starts[i]] = offset;
+            any |= offset != 0;
+        }
+        if (any) {
+            size_t size = janet_v_count(aux) * sizeof(uint32_t);
+            result = janet_malloc(size);
+            if (NULL == result) {
+                JANET_OUT_OF_MEMORY;
+            }
+            memcpy(result, aux, size);
+        }
+        janet_v_free(aux);
+    }
+
+    janet_free(sets);
+    janet_free(flags);
+    janet_free(starts);
+    return result;
+}
+
+/* Choose the rules to memoize: those that can be reached from more than one
+ * place, except for primitive rules that are cheaper to match than to look up.
+ * Returns a malloced table with one word per bytecode word giving the memo slot
+ * of the instruction (or 0), or NULL if there is nothing to memoize. */
+static uint32_t *peg_memo_slots(const uint32_t *bytecode, uint32_t blen) {
+    if (blen == 0) return NULL;
+    uint32_t *slots = janet_calloc(blen, sizeof(uint32_t));
+    if (NULL == slots) {
+        JANET_OUT_OF_MEMORY;
+    }
+    /* Count references to each instruction */
+    slots[0] = 1;
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i)) {
+        const uint32_t *children;
+        uint32_t n = peg_rule_children(bytecode + i, &children);
+        for (uint32_t j = 0; j < n; j++) slots[children[j]]++;
+    }
+    /* Number the rules to memoize */
+    uint32_t nslots = 0;
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i)) {
+        switch (bytecode[i] & 0x1F) {
+            case RULE_LITERAL:
+            case RULE_NCHAR:
+            case RULE_NOTNCHAR:
+            case RULE_RANGE:
+            case RULE_SET:
+            case RULE_GETTAG:
+            case RULE_POSITION:
+            case RULE_ARGUMENT:
+            case RULE_CONSTANT:
+            case RULE_BACKMATCH:
+            case RULE_READINT:
+            case RULE_LINE:
+            case RULE_COLUMN:
+                slots[i] = 0;
+                break;
+            default:
+                slots[i] = (slots[i] > 1) ? ++nslots : 0;
+                break;
+        }
+    }
+    if (nslots == 0) {
+        janet_free(slots);
+        return NULL;
+    }
+    return slots;
+}
+
+/*
+ * Native code
+ */
+
+#ifdef JANET_PEG_NATIVE
+
+/* Rules that only match text, without captures or calls back into Janet, are
+ * compiled to x86-64 functions. A function takes the position in rdi, the end of
+ * the text in rsi, the recursion depth left in rdx and the start of the text in
+ * rcx, and returns the new position or NULL in rax. It keeps rsi, rdx and rcx,
+ * and uses its stack frame to save positions for backtracking. Rules used from
+ * more than one place or from interpreted rules become functions, and the rest
+ * are inlined into them. */
+
+#define PEG_JIT_NONE 0
+#define PEG_JIT_INLINE 1
+#define PEG_JIT_FUNCTION 2
+
+/* x86-64 registers and condition codes */
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RSI 6
+#define JIT_RDI 7
+#define JIT_B 0x2
+#define JIT_AE 0x3
+#define JIT_E 0x4
+#define JIT_NE 0x5
+#define JIT_A 0x7
+
+typedef struct {
+    uint8_t *code;
+    int32_t *labels;
+    int32_t *fixups; /* Pairs of (offset of rel32, label) */
+    int32_t *func_labels;
+    uint8_t *kind;
+    const uint32_t *bytecode;
+    const uint32_t *first;
+    uint32_t slots;
+} PegJit;
+
+static void peg_native_overflow(void) {
+    janet_panic("peg/match recursed too deeply");
+}
+
+static void jit_emit(PegJit *j, int n, ...) {
+    va_list args;
+    va_start(args, n);
+    for (int i = 0; i < n; i++) janet_v_push(j->code, (uint8_t) va_arg(args, int));
+    va_end(args);
+}
+
+static void jit_u32(PegJit *j, uint32_t x) {
+    for (int i = 0; i < 4; i++) janet_v_push(j->code, (uint8_t)(x >> (8 * i)));
+}
+
+static void jit_u64(PegJit *j, uint64_t x) {
+    for (int i = 0; i < 8; i++) janet_v_push(j->code, (uint8_t)(x >> (8 * i)));
+}
+
+static int32_t jit_label(PegJit *j) {
+    janet_v_push(j->labels, -1);
+    return janet_v_count(j->labels) - 1;
+}
+
+static void jit_bind(PegJit *j, int32_t label) {
+    j->labels[label] = janet_v_count(j->code);
+}
+
+static void jit_rel(PegJit *j, int32_t label) {
+    janet_v_push(j->fixups, janet_v_count(j->code));
+    janet_v_push(j->fixups, label);
+    jit_u32(j, 0);
+}
+
+static void jit_jmp(PegJit *j, int32_t label) {
+    jit_emit(j, 1, 0xE9);
+    jit_rel(j, label);
+}
+
+static void jit_jcc(PegJit *j, int cc, int32_t label) {
+    jit_emit(j, 2, 0x0F, 0x80 | cc);
+    jit_rel(j, label);
+}
+
+/* mov [rsp + 8 * slot], reg */
+static void jit_store(PegJit *j, int reg, uint32_t slot) {
+    if (slot + 1 > j->slots) j->slots = slot + 1;
+    jit_emit(j, 4, 0x48, 0x89, 0x84 | (reg << 3), 0x24);
+    jit_u32(j, 8 * slot);
+}
+
+/* mov reg, [rsp + 8 * slot] */
+static void jit_load(PegJit *j, int reg, uint32_t slot) {
+    jit_emit(j, 4, 0x48, 0x8B, 0x84 | (reg << 3), 0x24);
+    jit_u32(j, 8 * slot);
+}
+
+/* mov r8, imm64 */
+static void jit_mov_r8(PegJit *j, const void *ptr) {
+    jit_emit(j, 2, 0x49, 0xB8);
+    jit_u64(j, (uint64_t)(uintptr_t) ptr);
+}
+
+/* Jump to label at the end of the text, else load the next byte into eax */
+static void jit_next_byte(PegJit *j, int32_t label) {
+    jit_emit(j, 3, 0x48, 0x39, 0xF7); /* cmp rdi, rsi */
+    jit_jcc(j, JIT_AE, label);
+    jit_emit(j, 3, 0x0F, 0xB6, 0x07); /* movzx eax, byte [rdi] */
+}
+
+/* Set the carry flag if bit eax of a 256 bit set is set */
+static void jit_test_set(PegJit *j, const uint32_t *set) {
+    jit_mov_r8(j, set);
+    jit_emit(j, 4, 0x41, 0x0F, 0xA3, 0x00); /* bt [r8], eax */
+}
+
+/* Set the flags for a byte in eax against a range, above if out of range */
+static void jit_test_range(PegJit *j, uint32_t range) {
+    uint32_t lo = range & 0xFF;
+    uint32_t hi = (range >> 16) & 0xFF;
+    if (hi < lo) {
+        /* Nothing is in an empty range */
+        jit_emit(j, 5, 0xB8, 1, 0, 0, 0); /* mov eax, 1 */
+        jit_emit(j, 3, 0x83, 0xF8, 0x00); /* cmp eax, 0 */
+        return;
+    }
+    jit_emit(j, 1, 0x2D); /* sub eax, lo */
+    jit_u32(j, lo);
+    jit_emit(j, 1, 0x3D); /* cmp eax, hi - lo */
+    jit_u32(j, hi - lo);
+}
+
+static const uint32_t *jit_annotation(PegJit *j, uint32_t at) {
+    if (NULL == j->first || 0 == j->first[at]) return NULL;
+    return j->first + j->first[at];
+}
+
+static void peg_jit_rule(PegJit *j, uint32_t at, int32_t fail, uint32_t slot, int top);
+
+/* Match rule_a as many times as possible, between lo and hi times. */
+static void peg_jit_between(PegJit *j, const uint32_t *rule, int32_t fail, uint32_t slot) {
+    uint32_t lo = rule[1];
+    uint32_t hi = rule[2];
+    const uint32_t *rule_a = j->bytecode + rule[3];
+    uint32_t op = rule_a[0] & 0x1F;
+    int32_t loop = jit_label(j);
+    int32_t done = jit_label(j);
+    if (j->kind[rule[3]] == PEG_JIT_INLINE && (op == RULE_SET || op == RULE_RANGE)) {
+        /* Single bytes, so the count is the distance moved */
+        jit_emit(j, 3, 0x49, 0x89, 0xF9); /* mov r9, rdi */
+        jit_bind(j, loop);
+        if (hi != UINT32_MAX) {
+            jit_emit(j, 3, 0x48, 0x89, 0xF8); /* mov rax, rdi */
+            jit_emit(j, 3, 0x4C, 0x29, 0xC8); /* sub rax, r9 */
+            jit_emit(j, 2, 0x41, 0xBA); /* mov r10d, hi */
+            jit_u32(j, hi);
+            jit_emit(j, 3, 0x4C, 0x39, 0xD0); /* cmp rax, r10 */
+            jit_jcc(j, JIT_AE, done);
+        }
+        jit_next_byte(j, done);
+        if (op == RULE_SET) {
+            jit_test_set(j, rule_a + 1);
+            jit_jcc(j, JIT_AE, done);
+        } else {
+            jit_test_range(j, rule_a[1]);
+            jit_jcc(j, JIT_A, done);
+        }
+        jit_emit(j, 3, 0x48, 0xFF, 0xC7); /* inc rdi */
+        jit_jmp(j, loop);
+        jit_bind(j, done);
+        if (lo > 0) {
+            jit_emit(j, 3, 0x48, 0x89, 0xF8); /* mov rax, rdi */
+            jit_emit(j, 3, 0x4C, 0x29, 0xC8); /* sub rax, r9 */
+            jit_emit(j, 2, 0x41, 0xBA); /* mov r10d, lo */
+            jit_u32(j, lo);
+            jit_emit(j, 3, 0x4C, 0x39, 0xD0); /* cmp rax, r10 */
+            jit_jcc(j, JIT_B, fail);
+        }
+        return;
+    }
+    /* Count in slot, position before each try in slot + 1 */
+    int32_t stop = jit_label(j);
+    if (slot + 2 > j->slots) j->slots = slot + 2;
+    jit_emit(j, 4, 0x48, 0xC7, 0x84, 0x24); /* mov qword [slot], 0 */
+    jit_u32(j, 8 * slot);
+    jit_u32(j, 0);
+    jit_bind(j, loop);
+    jit_emit(j, 1, 0xB8); /* mov eax, hi */
+    jit_u32(j, hi);
+    jit_emit(j, 4, 0x48, 0x39, 0x84, 0x24); /* cmp [slot], rax */
+    jit_u32(j, 8 * slot);
+    jit_jcc(j, JIT_AE, done);
+    jit_store(j, JIT_RDI, slot + 1);
+    peg_jit_rule(j, rule[3], stop, slot + 2, 0);
+    jit_emit(j, 4, 0x48, 0x3B, 0xBC, 0x24); /* cmp rdi, [slot + 1] */
+    jit_u32(j, 8 * (slot + 1));
+    jit_jcc(j, JIT_E, done);
+    jit_emit(j, 4, 0x48, 0xFF, 0x84, 0x24); /* inc qword [slot] */
+    jit_u32(j, 8 * slot);
+    jit_jmp(j, loop);
+    jit_bind(j, stop);
+    jit_load(j, JIT_RDI, slot + 1);
+    jit_bind(j, done);
+    if (lo > 0) {
+        jit_emit(j, 1, 0xB8); /* mov eax, lo */
+        jit_u32(j, lo);
+        jit_emit(j, 4, 0x48, 0x39, 0x84, 0x24); /* cmp [slot], rax */
+        jit_u32(j, 8 * slot);
+        jit_jcc(j, JIT_B, fail);
+    }
+}
+
+/* Search for the first position where rule_a matches */
+static void peg_jit_to(PegJit *j, uint32_t at, int32_t fail, uint32_t slot) {
+    const uint32_t *rule = j->bytecode + at;
+    const uint32_t *scan = jit_annotation(j, at);
+    int32_t loop = jit_label(j);
+    int32_t next = jit_label(j);
+    int32_t done = jit_label(j);
+    jit_bind(j, loop);
+    jit_emit(j, 3, 0x48, 0x39, 0xF7); /* cmp rdi, rsi */
+    jit_jcc(j, JIT_A, fail);
+    if (NULL != scan && scan[0] == PEG_SCAN_BYTE) {
+        /* Skip ahead with memchr, keeping rsi, rdx and rcx */
+        jit_store(j, JIT_RSI, slot);
+        jit_store(j, JIT_RDX, slot + 1);
+        jit_store(j, JIT_RCX, slot + 2);
+        jit_emit(j, 3, 0x48, 0x89, 0xF2); /* mov rdx, rsi */
+        jit_emit(j, 3, 0x48, 0x29, 0xFA); /* sub rdx, rdi */
+        jit_emit(j, 1, 0xBE); /* mov esi, byte */
+        jit_u32(j, scan[1]);
+        jit_emit(j, 2, 0x48, 0xB8); /* mov rax, memchr */
+        jit_u64(j, (uint64_t)(uintptr_t) memchr);
+        jit_emit(j, 2, 0xFF, 0xD0); /* call rax */
+        jit_load(j, JIT_RSI, slot);
+        jit_load(j, JIT_RDX, slot + 1);
+        jit_load(j, JIT_RCX, slot + 2);
+        jit_emit(j, 3, 0x48, 0x85, 0xC0); /* test rax, rax */
+        jit_jcc(j, JIT_E, fail);
+        jit_emit(j, 3, 0x48, 0x89, 0xC7); /* mov rdi, rax */
+    } else if (NULL != scan) {
+        int32_t scan_loop = jit_label(j);
+        int32_t found = jit_label(j);
+        jit_bind(j, scan_loop);
+        jit_next_byte(j, fail);
+        jit_test_set(j, scan + 1);
+        jit_jcc(j, JIT_B, found);
+        jit_emit(j, 3, 0x48, 0xFF, 0xC7); /* inc rdi */
+        jit_jmp(j, scan_loop);
+        jit_bind(j, found);
+    }
+    jit_store(j, JIT_RDI, slot);
+    peg_jit_rule(j, rule[1], next, slot + 1, 0);
+    if (rule[0] == RULE_TO) jit_load(j, JIT_RDI, slot);
+    jit_jmp(j, done);
+    jit_bind(j, next);
+    jit_load(j, JIT_RDI, slot);
+    jit_emit(j, 3, 0x48, 0xFF, 0xC7); /* inc rdi */
+    jit_jmp(j, loop);
+    jit_bind(j, done);
+}
+
+/* Try the alternatives of a choice in order */
+static void peg_jit_choice(PegJit *j, uint32_t at, int32_t fail, uint32_t slot) {
+    const uint32_t *rule = j->bytecode + at;
+    const uint32_t *first = jit_annotation(j, at);
+    uint32_t len = rule[1];
+    int32_t done = jit_label(j);
+    if (len == 0) {
+        jit_jmp(j, fail);
+        return;
+    }
+    if (NULL != first && first[0] == PEG_CHOICE_DISPATCH) {
+        /* At most one alternative can match, so jump straight to it */
+        int32_t *alts = janet_smalloc(len * sizeof(int32_t));
+        jit_next_byte(j, fail);
+        jit_mov_r8(j, first + 1);
+        jit_emit(j, 5, 0x41, 0x0F, 0xB6, 0x04, 0x00); /* movzx eax, byte [r8 + rax] */
+        for (uint32_t i = 0; i < len; i++) {
+            alts[i] = jit_label(j);
+            jit_emit(j, 1, 0x3D); /* cmp eax, i */
+            jit_u32(j, i);
+            jit_jcc(j, JIT_E, alts[i]);
+        }
+        jit_jmp(j, fail);
+        for (uint32_t i = 0; i < len; i++) {
+            jit_bind(j, alts[i]);
+            peg_jit_rule(j, rule[2 + i], fail, slot, 0);
+            jit_jmp(j, done);
+        }
+        janet_sfree(alts);
+        jit_bind(j, done);
+        return;
+    }
+    jit_store(j, JIT_RDI, slot);
+    for (uint32_t i = 0; i < len; i++) {
+        int last = i == len - 1;
+        int32_t next = last ? fail : jit_label(j);
+        if (NULL != first && !first[1 + 9 * i]) {
+            jit_next_byte(j, next);
+            jit_test_set(j, first + 2 + 9 * i);
+            jit_jcc(j, JIT_AE, next);
+        }
+        peg_jit_rule(j, rule[2 + i], next, slot + 1, 0);
+        if (!last) {
+            jit_jmp(j, done);
+            jit_bind(j, next);
+            jit_load(j, JIT_RDI, slot);
+        }
+    }
+    jit_bind(j, done);
+}
+
+/* Emit code that advances rdi past a match of the rule at `at`, or jumps to
+ * fail. Slots from slot up are free for saving state. */
+static void peg_jit_rule(PegJit *j, uint32_t at, int32_t fail, uint32_t slot, int top) {
+    const uint32_t *rule = j->bytecode + at;
+    if (!top && j->kind[at] == PEG_JIT_FUNCTION) {
+        jit_emit(j, 1, 0xE8); /* call */
+        jit_rel(j, j->func_labels[at]);
+        jit_emit(j, 3, 0x48, 0x85, 0xC0); /* test rax, rax */
+        jit_jcc(j, JIT_E, fail);
+        jit_emit(j, 3, 0x48, 0x89, 0xC7); /* mov rdi, rax */
+        return;
+    }
+    switch (rule[0] & 0x1F) {
+        default:
+            janet_panic("unexpected opcode");
+            break;
+
+        case RULE_LITERAL: {
+            uint32_t len = rule[1];
+            const uint8_t *bytes = (const uint8_t *)(rule + 2);
+            if (len == 0) break;
+            jit_emit(j, 3, 0x48, 0x8D, 0x87); /* lea rax, [rdi + len] */
+            jit_u32(j, len);
+            jit_emit(j, 3, 0x48, 0x39, 0xF0); /* cmp rax, rsi */
+            jit_jcc(j, JIT_A, fail);
+            uint32_t k = 0;
+            for (; k + 8 <= len; k += 8) {
+                uint64_t word;
+                memcpy(&word, bytes + k, 8);
+                jit_emit(j, 2, 0x48, 0xB8); /* mov rax, word */
+                jit_u64(j, word);
+                jit_emit(j, 3, 0x48, 0x39, 0x87); /* cmp [rdi + k], rax */
+                jit_u32(j, k);
+                jit_jcc(j, JIT_NE, fail);
+            }
+            if (k + 4 <= len) {
+                uint32_t word;
+                memcpy(&word, bytes + k, 4);
+                jit_emit(j, 2, 0x81, 0xBF); /* cmp dword [rdi + k], word */
+                jit_u32(j, k);
+                jit_u32(j, word);
+                jit_jcc(j, JIT_NE, fail);
+                k += 4;
+            }
+            for (; k < len; k++) {
+                jit_emit(j, 2, 0x80, 0xBF); /* cmp byte [rdi + k], byte */
+                jit_u32(j, k);
+                jit_emit(j, 1, bytes[k]);
+                jit_jcc(j, JIT_NE, fail);
+            }
+            jit_emit(j, 3, 0x48, 0x8D, 0xBF); /* lea rdi, [rdi + len] */
+            jit_u32(j, len);
+            break;
+        }
+
+        case RULE_NCHAR:
+            jit_emit(j, 3, 0x48, 0x8D, 0x87); /* lea rax, [rdi + n] */
+            jit_u32(j, rule[1]);
+            jit_emit(j, 3, 0x48, 0x39, 0xF0); /* cmp rax, rsi */
+            jit_jcc(j, JIT_A, fail);
+            jit_emit(j, 3, 0x48, 0x89, 0xC7); /* mov rdi, rax */
+            break;
+
+        case RULE_NOTNCHAR:
+            jit_emit(j, 3, 0x48, 0x8D, 0x87); /* lea rax, [rdi + n] */
+            jit_u32(j, rule[1]);
+            jit_emit(j, 3, 0x48, 0x39, 0xF0); /* cmp rax, rsi */
+            jit_jcc(j, 0x6, fail); /* jbe */
+            break;
+
+        case RULE_RANGE:
+            jit_next_byte(j, fail);
+            jit_test_range(j, rule[1]);
+            jit_jcc(j, JIT_A, fail);
+            jit_emit(j, 3, 0x48, 0xFF, 0xC7); /* inc rdi */
+            break;
+
+        case RULE_SET:
+            jit_next_byte(j, fail);
+            jit_test_set(j, rule + 1);
+            jit_jcc(j, JIT_AE, fail);
+            jit_emit(j, 3, 0x48, 0xFF, 0xC7); /* inc rdi */
+            break;
+
+        case RULE_LOOK:
+            jit_store(j, JIT_RDI, slot);
+            jit_emit(j, 3, 0x48, 0x8D, 0xBF); /* lea rdi, [rdi + offset] */
+            jit_u32(j, rule[1]);
+            jit_emit(j, 3, 0x48, 0x39, 0xCF); /* cmp rdi, rcx */
+            jit_jcc(j, JIT_B, fail);
+            jit_emit(j, 3, 0x48, 0x39, 0xF7); /* cmp rdi, rsi */
+            jit_jcc(j, JIT_A, fail);
+            peg_jit_rule(j, rule[2], fail, slot + 1, 0);
+            jit_load(j, JIT_RDI, slot);
+            break;
+
+        case RULE_CHOICE:
+            peg_jit_choice(j, at, fail, slot);
+            break;
+
+        case RULE_SEQUENCE:
+            for (uint32_t i = 0; i < rule[1]; i++)
+                peg_jit_rule(j, rule[2 + i], fail, slot, 0);
+            break;
+
+        case RULE_IF:
+            jit_store(j, JIT_RDI, slot);
+            peg_jit_rule(j, rule[1], fail, slot + 1, 0);
+            jit_load(j, JIT_RDI, slot);
+            peg_jit_rule(j, rule[2], fail, slot, 0);
+            break;
+
+        case RULE_IFNOT:
+        case RULE_NOT: {
+            int32_t ok = jit_label(j);
+            jit_store(j, JIT_RDI, slot);
+            peg_jit_rule(j, rule[1], ok, slot + 1, 0);
+            jit_jmp(j, fail);
+            jit_bind(j, ok);
+            jit_load(j, JIT_RDI, slot);
+            if ((rule[0] & 0x1F) == RULE_IFNOT)
+                peg_jit_rule(j, rule[2], fail, slot, 0);
+            break;
+        }
+
+        case RULE_BETWEEN:
+            peg_jit_between(j, rule, fail, slot);
+            break;
+
+        case RULE_TO:
+        case RULE_THRU:
+            peg_jit_to(j, at, fail, slot);
+            break;
+
+        case RULE_DROP:
+            peg_jit_rule(j, rule[1], fail, slot, 0);
+            break;
+    }
+}
+
+/* Rules that only move through the text can be compiled */
+static int peg_jit_ok(const uint32_t *rule) {
+    switch (rule[0] & 0x1F) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+            return rule[1] <= INT32_MAX;
+        case RULE_RANGE:
+        case RULE_SET:
+        case RULE_LOOK:
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_NOT:
+        case RULE_BETWEEN:
+        case RULE_TO:
+        case RULE_THRU:
+        case RULE_DROP:
+            return 1;
+    }
+}
+
+static void peg_native_free(PegNative *native) {
+    if (NULL == native) return;
+    munmap(native->code, native->size);
+    janet_free(native);
+}
+
+/* Compile the rules of validated bytecode that can be compiled. Returns NULL
+ * if there are none, or if executable memory is not available. */
+static PegNative *peg_native_compile(const uint32_t *bytecode, uint32_t blen, const uint32_t *first) {
+    if (blen == 0) return NULL;
+    PegJit j;
+    j.code = NULL;
+    j.labels = NULL;
+    j.fixups = NULL;
+    j.bytecode = bytecode;
+    j.first = first;
+    j.slots = 0;
+    j.kind = janet_smalloc(blen);
+    j.func_labels = janet_smalloc(blen * sizeof(int32_t));
+    uint32_t *refs = janet_smalloc(2 * blen * sizeof(uint32_t));
+    memset(j.kind, PEG_JIT_NONE, blen);
+    memset(refs, 0, 2 * blen * sizeof(uint32_t));
+
+    /* Find the rules that can be compiled along with everything they use */
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i))
+        if (peg_jit_ok(bytecode + i)) j.kind[i] = PEG_JIT_INLINE;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i)) {
+            if (j.kind[i] == PEG_JIT_NONE) continue;
+            const uint32_t *children;
+            uint32_t n = peg_rule_children(bytecode + i, &children);
+            for (uint32_t k = 0; k < n; k++) {
+                if (j.kind[children[k]] == PEG_JIT_NONE) {
+                    j.kind[i] = PEG_JIT_NONE;
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Rules used from interpreted rules or from more than one place get
+     * functions. refs holds all uses, then uses from compiled rules. */
+    refs[0] = 1;
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i)) {
+        const uint32_t *children;
+        uint32_t n = peg_rule_children(bytecode + i, &children);
+        for (uint32_t k = 0; k < n; k++) {
+            refs[children[k]]++;
+            if (j.kind[i] != PEG_JIT_NONE) refs[blen + children[k]]++;
+        }
+    }
+    int any = 0;
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i)) {
+        if (j.kind[i] == PEG_JIT_NONE || refs[i] == 0) continue;
+        if (refs[i] > 1 || refs[blen + i] != refs[i]) {
+            j.kind[i] = PEG_JIT_FUNCTION;
+            j.func_labels[i] = jit_label(&j);
+            any = 1;
+        }
+    }
+    janet_sfree(refs);
+    if (!any) {
+        janet_sfree(j.kind);
+        janet_sfree(j.func_labels);
+        return NULL;
+    }
+
+    /* The recursion guard is at offset 0, so no function starts there */
+    int32_t overflow = jit_label(&j);
+    jit_bind(&j, overflow);
+    jit_emit(&j, 4, 0x48, 0x83, 0xEC, 0x08); /* sub rsp, 8 */
+    jit_emit(&j, 2, 0x48, 0xB8); /* mov rax, peg_native_overflow */
+    jit_u64(&j, (uint64_t)(uintptr_t) peg_native_overflow);
+    jit_emit(&j, 2, 0xFF, 0xD0); /* call rax */
+
+    for (uint32_t i = 0; i < blen; i += peg_rule_len(bytecode + i)) {
+        if (j.kind[i] != PEG_JIT_FUNCTION) continue;
+        int32_t fail = jit_label(&j);
+        jit_bind(&j, j.func_labels[i]);
+        jit_emit(&j, 3, 0x48, 0xFF, 0xCA); /* dec rdx */
+        jit_jcc(&j, JIT_E, overflow);
+        jit_emit(&j, 3, 0x48, 0x81, 0xEC); /* sub rsp, frame */
+        int32_t frame_at = janet_v_count(j.code);
+        jit_u32(&j, 0);
+        j.slots = 0;
+        peg_jit_rule(&j, i, fail, 0, 1);
+        /* Keep the stack aligned for calls */
+        uint32_t frame = 8 * (j.slots | 1);
+        memcpy(j.code + frame_at, &frame, 4);
+        jit_emit(&j, 3, 0x48, 0x89, 0xF8); /* mov rax, rdi */
+        jit_emit(&j, 3, 0x48, 0x81, 0xC4); /* add rsp, frame */
+        jit_u32(&j, frame);
+        jit_emit(&j, 3, 0x48, 0xFF, 0xC2); /* inc rdx */
+        jit_emit(&j, 1, 0xC3); /* ret */
+        jit_bind(&j, fail);
+        jit_emit(&j, 2, 0x31, 0xC0); /* xor eax, eax */
+        jit_emit(&j, 3, 0x48, 0x81, 0xC4); /* add rsp, frame */
+        jit_u32(&j, frame);
+        jit_emit(&j, 3, 0x48, 0xFF, 0xC2); /* inc rdx */
+        jit_emit(&j, 1, 0xC3); /* ret */
+    }
+
+    /* Link and map */
+    for (int32_t k = 0; k < janet_v_count(j.fixups); k += 2) {
+        int32_t at = j.fixups[k];
+        int32_t rel = j.labels[j.fixups[k + 1]] - (at + 4);
+        memcpy(j.code + at, &rel, 4);
+    }
+    size_t size = janet_v_count(j.code);
+    PegNative *native = NULL;
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        memcpy(mem, j.code, size);
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC)) {
+            munmap(mem, size);
+        } else {
+            native = janet_malloc(sizeof(PegNative) + blen * sizeof(uint32_t));
+            if (NULL == native) {
+                JANET_OUT_OF_MEMORY;
+            }
+            native->code = mem;
+            native->size = size;
+            for (uint32_t i = 0; i < blen; i++) {
+                native->entries[i] = (j.kind[i] == PEG_JIT_FUNCTION)
+                                     ? (uint32_t) j.labels[j.func_labels[i]]
+                                     : 0;
+            }
+        }
+    }
+    janet_v_free(j.code);
+    janet_v_free(j.labels);
+    janet_v_free(j.fixups);
+    janet_sfree(j.kind);
+    janet_sfree(j.func_labels);
+    return native;
+}
+
+#else
+
+static void peg_native_free(PegNative *native) {
+    (void) native;
+}
+
+static PegNative *peg_native_compile(const uint32_t *bytecode, uint32_t blen, const uint32_t *first) {
+    (void) bytecode;
+    (void) blen;
+    (void) first;
+    return NULL;
+}
+
+#endif
+
 /*
  * Post-Compilation
  */
@@ -1356,6 +2719,15 @@ static int peg_mark(void *p, size_t size) {
     return 0;
 }
 
+static int peg_gc(void *p, size_t size) {
+    (void) size;
+    JanetPeg *peg = (JanetPeg *)p;
+    janet_free(peg->first);
+    janet_free(peg->memo);
+    peg_native_free(peg->native);
+    return 0;
+}
+
 static void peg_marshal(void *p, JanetMarshalContext *ctx) {
     JanetPeg *peg = (JanetPeg *)p;
     janet_marshal_size(ctx, peg->bytecode_len);
@@ -1365,6 +2737,8 @@ static void peg_marshal(void *p, JanetMarshalContext *ctx) {
         janet_marshal_int(ctx, (int32_t) peg->bytecode[i]);
     for (uint32_t j = 0; j < peg->num_constants; j++)
         janet_marshal_janet(ctx, peg->constants[j]);
+    janet_marshal_size(ctx, (NULL == peg->memo) ? 0 : peg->memo_budget);
+    janet_marshal_int(ctx, NULL != peg->native);
 }
 
 /* Used to ensure that if we place several arrays in one memory chunk, each
@@ -1394,6 +2768,12 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
     Janet *constants = (Janet *)(mem + constants_start);
     peg->bytecode = NULL;
     peg->constants = NULL;
+    peg->first = NULL;
+    peg->memo = NULL;
+    peg->native = NULL;
+    peg->memo_hits = 0;
+    peg->memo_misses = 0;
+    peg->memo_flushes = 0;
     peg->bytecode_len = bytecode_len;
     peg->num_constants = num_constants;
 
@@ -1401,6 +2781,8 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
         bytecode[i] = (uint32_t) janet_unmarshal_int(ctx);
     for (uint32_t j = 0; j < peg->num_constants; j++)
         constants[j] = janet_unmarshal_janet(ctx);
+    peg->memo_budget = janet_unmarshal_size(ctx);
+    int native = janet_unmarshal_int(ctx);
 
     /* After here, no panics except for the bad: label. */
 
@@ -1550,6 +2932,9 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
     peg->constants = constants;
     peg->has_backref = has_backref;
     janet_free(op_flags);
+    peg->first = peg_first_sets(bytecode, blen);
+    if (peg->memo_budget) peg->memo = peg_memo_slots(bytecode, blen);
+    if (native) peg->native = peg_native_compile(bytecode, blen, peg->first);
     return peg;
 
 bad:
@@ -1562,7 +2947,7 @@ static Janet peg_next(void *p, Janet key);
 
 const JanetAbstractType janet_peg_type = {
     "core/peg",
-    NULL,
+    peg_gc,
     peg_mark,
     cfun_peg_getter,
     NULL, /* put */
@@ -1591,11 +2976,19 @@ static JanetPeg *make_peg(Builder *b) {
     safe_memcpy(peg->constants, b->constants, constants_size);
     peg->bytecode_len = janet_v_count(b->bytecode);
     peg->has_backref = b->has_backref;
+    peg->first = NULL;
+    peg->memo = NULL;
+    peg->native = NULL;
+    peg->memo_budget = 0;
+    peg->memo_hits = 0;
+    peg->memo_misses = 0;
+    peg->memo_flushes = 0;
+    peg->first = peg_first_sets(peg->bytecode, (uint32_t) peg->bytecode_len);
     return peg;
 }
 
 /* Compiler entry point */
-static JanetPeg *compile_peg(Janet x) {
+static JanetPeg *compile_peg(Janet x, JanetPegCacheEntry *cache) {
     Builder builder;
     builder.grammar = janet_table(0);
     builder.default_grammar = NULL;
@@ -1606,32 +2999,164 @@ static JanetPeg *compile_peg(Janet x) {
         }
     }
     builder.tags = janet_table(0);
+    builder.deps = NULL;
     builder.constants = NULL;
     builder.bytecode = NULL;
     builder.nexttag = 1;
     builder.form = x;
     builder.depth = JANET_RECURSION_GUARD;
     builder.has_backref = 0;
+    builder.cacheable = 1;
     peg_compile1(&builder, x);
     JanetPeg *peg = make_peg(&builder);
     builder_cleanup(&builder);
+    if (NULL != cache && builder.cacheable) {
+        cache->key = x;
+        cache->peg = peg;
+        cache->deps = (NULL == builder.deps) ? NULL : janet_table_to_struct(builder.deps);
+    }
     return peg;
 }
 
+/*
+ * Compiled peg cache
+ */
+
+/* Find the cache slot for a grammar, or NULL if the grammar should not
+ * be cached. Only immutable grammars are cached, and grammars that contain
+ * tables are skipped when they are compiled. */
+static JanetPegCacheEntry *peg_cache_slot(Janet x) {
+    switch (janet_type(x)) {
+        default:
+            return NULL;
+        case JANET_STRING:
+        case JANET_KEYWORD:
+        case JANET_TUPLE:
+        case JANET_STRUCT:
+            break;
+    }
+    uintptr_t h = (uintptr_t) janet_unwrap_pointer(x);
+    h ^= h >> 11;
+    h *= 0x9E3779B1u;
+    return janet_vm.peg_cache + ((h >> 8) & (JANET_PEG_CACHE_SIZE - 1));
+}
+
+/* Check that the rules a cached peg took from the default grammar are unchanged */
+static int peg_cache_valid(const JanetKV *deps) {
+    if (NULL == deps) return 1;
+    Janet default_grammarv = janet_dyn("peg-grammar");
+    if (!janet_checktype(default_grammarv, JANET_TABLE)) return 0;
+    JanetTable *default_grammar = janet_unwrap_table(default_grammarv);
+    for (int32_t i = 0; i < janet_struct_capacity(deps); i++) {
+        if (janet_checktype(deps[i].key, JANET_NIL)) continue;
+        if (!janet_equals(janet_table_get(default_grammar, deps[i].key), deps[i].value))
+            return 0;
+    }
+    return 1;
+}
+
+/* Get a compiled peg for a grammar, compiling it on a cache miss */
+static JanetPeg *compile_peg_cached(Janet x) {
+    JanetPegCacheEntry *cache = peg_cache_slot(x);
+    if (NULL != cache && janet_checktype(cache->key, janet_type(x)) &&
+            janet_unwrap_pointer(cache->key) == janet_unwrap_pointer(x) &&
+            peg_cache_valid(cache->deps)) {
+        return cache->peg;
+    }
+    return compile_peg(x, cache);
+}
+
+/* Called by the gc once the roots are marked. Entries whose grammars were not
+ * reached are dropped, so the cache never keeps a grammar alive. */
+void janet_peg_cache_mark(void) {
+    for (int32_t i = 0; i < JANET_PEG_CACHE_SIZE; i++) {
+        JanetPegCacheEntry *entry = janet_vm.peg_cache + i;
+        JanetGCObject *key;
+        switch (janet_type(entry->key)) {
+            default:
+                continue;
+            case JANET_STRING:
+            case JANET_KEYWORD:
+                key = &janet_string_head(janet_unwrap_string(entry->key))->gc;
+                break;
+            case JANET_TUPLE:
+                key = &janet_tuple_head(janet_unwrap_tuple(entry->key))->gc;
+                break;
+            case JANET_STRUCT:
+                key = &janet_struct_head(janet_unwrap_struct(entry->key))->gc;
+                break;
+        }
+        if (key->flags & (JANET_MEM_REACHABLE | JANET_MEM_STATIC)) {
+            janet_mark(janet_wrap_abstract(entry->peg));
+            if (NULL != entry->deps) janet_mark(janet_wrap_struct(entry->deps));
+        } else {
+            entry->key = janet_wrap_nil();
+            entry->peg = NULL;
+            entry->deps = NULL;
+        }
+    }
+}
+
 /*
  * C Functions
  */
 
 JANET_CORE_FN(cfun_peg_compile,
-              "(peg/compile peg)",
+              "(peg/compile peg &opt flag memo-size)",
               "Compiles a peg source data structure into a <core/peg>. This will speed up matching "
               "if the same peg will be used multiple times. Will also use `(dyn :peg-grammar)` to suppliment "
-              "the grammar of the peg for otherwise undefined peg keywords.") {
-    janet_fixarity(argc, 1);
-    JanetPeg *peg = compile_peg(argv[0]);
+              "the grammar of the peg for otherwise undefined peg keywords. If flag is :memo, the "
+              "peg remembers the results of rules that are used in more than one place at each position "
+              "during a match (packrat parsing). This keeps heavily backtracking grammars from taking "
+              "exponential time, but functions in `cmt` and `replace` may be called fewer times. The "
+              "results are kept in up to memo-size bytes, which defaults to 16 MiB. Pegs with back-references "
+              "are not memoized. If flag is :native, rules that only match text, without captures or "
+              "functions, are compiled to machine code where that is supported (x86-64, except on Windows). "
+              "Other rules are still interpreted.") {
+    janet_arity(argc, 1, 3);
+    size_t memo_budget = 0;
+    int native = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        if (janet_keyeq(argv[1], "native")) {
+            native = 1;
+        } else if (janet_keyeq(argv[1], "memo")) {
+            memo_budget = janet_optsize(argv, argc, 2, 16 * 1024 * 1024);
+            if (memo_budget == 0) memo_budget = 1;
+        } else {
+            janet_panicf("expected :memo or :native, got %v", argv[1]);
+        }
+    }
+    JanetPeg *peg = compile_peg(argv[0], NULL);
+    if (memo_budget) {
+        peg->memo_budget = memo_budget;
+        peg->memo = peg_memo_slots(peg->bytecode, (uint32_t) peg->bytecode_len);
+    }
+    if (native) {
+        peg->native = peg_native_compile(peg->bytecode, (uint32_t) peg->bytecode_len, peg->first);
+    }
     return janet_wrap_abstract(peg);
 }
 
+JANET_CORE_FN(cfun_peg_memo_stats,
+              "(peg/memo-stats peg)",
+              "Get statistics for a peg compiled with the :memo flag. Returns a struct with the number of "
+              ":hits and :misses of the memo table over all matches, the number of times it outgrew "
+              "its size and was emptied as :flushes, and the number of :rules that are memoized.") {
+    janet_fixarity(argc, 1);
+    JanetPeg *peg = janet_getabstract(argv, 0, &janet_peg_type);
+    uint32_t rules = 0;
+    if (NULL != peg->memo) {
+        for (size_t i = 0; i < peg->bytecode_len; i++)
+            if (peg->memo[i] > rules) rules = peg->memo[i];
+    }
+    JanetKV *st = janet_struct_begin(4);
+    janet_struct_put(st, janet_ckeywordv("hits"), janet_wrap_number((double) peg->memo_hits));
+    janet_struct_put(st, janet_ckeywordv("misses"), janet_wrap_number((double) peg->memo_misses));
+    janet_struct_put(st, janet_ckeywordv("flushes"), janet_wrap_number((double) peg->memo_flushes));
+    janet_struct_put(st, janet_ckeywordv("rules"), janet_wrap_number((double) rules));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
 /* Common data for peg cfunctions */
 typedef struct {
     JanetPeg *peg;
@@ -1650,7 +3175,7 @@ static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
             janet_abstract_type(janet_unwrap_abstract(argv[0])) == &janet_peg_type) {
         ret.peg = janet_unwrap_abstract(argv[0]);
     } else {
-        ret.peg = compile_peg(argv[0]);
+        ret.peg = compile_peg_cached(argv[0]);
     }
     if (get_replace) {
         ret.repl = janet_getbytes(argv, 1);
@@ -1677,12 +3202,28 @@ static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
     ret.s.tags = janet_buffer(10);
     ret.s.constants = ret.peg->constants;
     ret.s.bytecode = ret.peg->bytecode;
+    ret.s.first = ret.peg->first;
     ret.s.linemap = NULL;
     ret.s.linemaplen = -1;
     ret.s.has_backref = ret.peg->has_backref;
+    ret.s.hit_end = 0;
+    ret.s.partial = 0;
+    ret.s.memo = peg_memo_init(ret.peg);
+    ret.s.memo_slots = ret.peg->memo;
+    ret.s.memo_skip = NULL;
+    ret.s.native = ret.peg->native;
     return ret;
 }
 
+/* Skip to the next position at or after i where the peg can match,
+ * or return -1 if there is none */
+static int32_t peg_call_scan(PegCall *c, int32_t i) {
+    if (NULL == c->s.first || 0 == c->s.first[c->peg->bytecode_len]) return i;
+    const uint32_t *scan = c->s.first + c->s.first[c->peg->bytecode_len];
+    const uint8_t *next = peg_scan(scan, c->bytes.bytes + i, c->s.text_end);
+    return NULL == next ? -1 : (int32_t)(next - c->bytes.bytes);
+}
+
 static void peg_call_reset(PegCall *c) {
     c->s.depth = JANET_RECURSION_GUARD;
     c->s.captures->count = 0;
@@ -1697,6 +3238,7 @@ JANET_CORE_FN(cfun_peg_match,
               "Returns nil if text does not match the language defined by peg. The syntax of PEGs is documented on the Janet website.") {
     PegCall c = peg_cfun_init(argc, argv, 0);
     const uint8_t *result = peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + c.start);
+    peg_memo_deinit(c.s.memo);
     return result ? janet_wrap_array(c.s.captures) : janet_wrap_nil();
 }
 
@@ -1704,12 +3246,17 @@ JANET_CORE_FN(cfun_peg_find,
               "(peg/find peg text &opt start & args)",
               "Find first index where the peg matches in text. Returns an integer, or nil if not found.") {
     PegCall c = peg_cfun_init(argc, argv, 0);
+    Janet ret = janet_wrap_nil();
     for (int32_t i = c.start; i < c.bytes.len; i++) {
+        if ((i = peg_call_scan(&c, i)) < 0) break;
         peg_call_reset(&c);
-        if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i))
-            return janet_wrap_integer(i);
+        if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i)) {
+            ret = janet_wrap_integer(i);
+            break;
+        }
     }
-    return janet_wrap_nil();
+    peg_memo_deinit(c.s.memo);
+    return ret;
 }
 
 JANET_CORE_FN(cfun_peg_find_all,
@@ -1718,10 +3265,12 @@ JANET_CORE_FN(cfun_peg_find_all,
     PegCall c = peg_cfun_init(argc, argv, 0);
     JanetArray *ret = janet_array(0);
     for (int32_t i = c.start; i < c.bytes.len; i++) {
+        if ((i = peg_call_scan(&c, i)) < 0) break;
         peg_call_reset(&c);
         if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i))
             janet_array_push(ret, janet_wrap_integer(i));
     }
+    peg_memo_deinit(c.s.memo);
     return janet_wrap_array(ret);
 }
 
@@ -1730,6 +3279,7 @@ static Janet cfun_peg_replace_generic(int32_t argc, Janet *argv, int only_one) {
     JanetBuffer *ret = janet_buffer(0);
     int32_t trail = 0;
     for (int32_t i = c.start; i < c.bytes.len;) {
+        if ((i = peg_call_scan(&c, i)) < 0) break;
         peg_call_reset(&c);
         const uint8_t *result = peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i);
         if (NULL != result) {
@@ -1750,6 +3300,7 @@ static Janet cfun_peg_replace_generic(int32_t argc, Janet *argv, int only_one) {
     if (trail < c.bytes.len) {
         janet_buffer_push_bytes(ret, c.bytes.bytes + trail, (c.bytes.len - trail));
     }
+    peg_memo_deinit(c.s.memo);
     return janet_wrap_buffer(ret);
 }
 
@@ -1766,6 +3317,554 @@ JANET_CORE_FN(cfun_peg_replace,
     return cfun_peg_replace_generic(argc, argv, 1);
 }
 
+/*
+ * Parallel matching
+ */
+
+#if defined(JANET_EV) && !defined(JANET_SINGLE_THREADED)
+#define PEG_PARALLEL
+#endif
+
+/* Smallest piece of text worth handing to its own thread */
+#define PEG_PARALLEL_MIN_CHUNK 65536
+
+/* Matches of a peg in part of a text. Workers write into malloc'd memory
+ * so results outlive the worker's VM. */
+typedef struct {
+    JanetPeg *peg;
+    const uint8_t *text;
+    int32_t len;
+    int32_t from;
+    int32_t to;
+    int replace;
+    int once;
+    int done;
+    int32_t *results; /* match starts, or (start, end) pairs when replacing */
+    int32_t count;
+    int32_t capacity;
+    int32_t next; /* First position after from that was not tried */
+    char *error;
+#ifdef PEG_PARALLEL
+#ifdef JANET_WINDOWS
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+#endif
+} PegWorker;
+
+static void peg_worker_push(PegWorker *w, int32_t x) {
+    if (w->count >= w->capacity) {
+        int32_t newcap = w->capacity ? 2 * w->capacity : 64;
+        int32_t *results = janet_realloc(w->results, newcap * sizeof(int32_t));
+        if (NULL == results) {
+            JANET_OUT_OF_MEMORY;
+        }
+        w->results = results;
+        w->capacity = newcap;
+    }
+    w->results[w->count++] = x;
+}
+
+/* Try the peg at each position in [from, to) like peg/find-all or
+ * peg/replace-all, using the current thread's VM for captures. Matches may
+ * run past to, but never start there. */
+static void peg_worker_scan(PegWorker *w, int collect) {
+    JanetPeg *peg = w->peg;
+    PegState s;
+    s.mode = PEG_MODE_NORMAL;
+    s.text_start = w->text;
+    s.text_end = w->text + w->len;
+    s.captures = janet_array(0);
+    s.tagged_captures = janet_array(0);
+    s.scratch = janet_buffer(10);
+    s.tags = janet_buffer(10);
+    s.constants = peg->constants;
+    s.bytecode = peg->bytecode;
+    s.first = peg->first;
+    s.linemap = NULL;
+    s.linemaplen = -1;
+    s.has_backref = peg->has_backref;
+    s.memo = NULL;
+    s.memo_slots = NULL;
+    s.memo_skip = NULL;
+    s.native = peg->native;
+    s.extrac = 0;
+    s.extrav = NULL;
+    if (collect) {
+        janet_gcroot(janet_wrap_array(s.captures));
+        janet_gcroot(janet_wrap_array(s.tagged_captures));
+        janet_gcroot(janet_wrap_buffer(s.scratch));
+        janet_gcroot(janet_wrap_buffer(s.tags));
+    }
+    const uint32_t *scan = NULL;
+    if (NULL != s.first && 0 != s.first[peg->bytecode_len])
+        scan = s.first + s.first[peg->bytecode_len];
+    int32_t i = w->from;
+    while (i < w->to) {
+        if (NULL != scan) {
+            const uint8_t *next = peg_scan(scan, w->text + i, s.text_end);
+            if (NULL == next) {
+                i = w->len;
+                break;
+            }
+            i = (int32_t)(next - w->text);
+            if (i >= w->to) break;
+        }
+        s.depth = JANET_RECURSION_GUARD;
+        s.hit_end = 0;
+        s.partial = 0;
+        s.captures->count = 0;
+        s.tagged_captures->count = 0;
+        s.scratch->count = 0;
+        s.tags->count = 0;
+        const uint8_t *result = peg_rule(&s, s.bytecode, w->text + i);
+        if (NULL == result) {
+            i++;
+        } else if (w->replace) {
+            int32_t end = (int32_t)(result - w->text);
+            peg_worker_push(w, i);
+            peg_worker_push(w, end);
+            i = (end == i) ? i + 1 : end;
+            if (w->once) break;
+        } else {
+            peg_worker_push(w, i);
+            i++;
+        }
+        if (collect && janet_vm.next_collection >= janet_vm.gc_interval) {
+            janet_collect();
+        }
+    }
+    w->next = i;
+    w->done = 1;
+}
+
+#ifdef PEG_PARALLEL
+
+static void peg_worker_run(PegWorker *w) {
+    janet_init();
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (JANET_SIGNAL_OK == signal) {
+        peg_worker_scan(w, 1);
+    } else {
+        const uint8_t *message = janet_to_string(tstate.payload);
+        int32_t len = janet_string_length(message);
+        w->error = janet_malloc(len + 1);
+        if (NULL == w->error) {
+            JANET_OUT_OF_MEMORY;
+        }
+        memcpy(w->error, message, len);
+        w->error[len] = '\0';
+    }
+    janet_restore(&tstate);
+    janet_deinit();
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI peg_worker_body(LPVOID ptr) {
+    peg_worker_run((PegWorker *) ptr);
+    return 0;
+}
+#else
+static void *peg_worker_body(void *ptr) {
+    peg_worker_run((PegWorker *) ptr);
+    return NULL;
+}
+#endif
+
+#endif
+
+/* Only pegs that never touch Janet values from the calling thread can run
+ * on other threads */
+static int peg_parallel_safe(JanetPeg *peg) {
+    const uint32_t *bytecode = peg->bytecode;
+    for (uint32_t i = 0; i < peg->bytecode_len; i += peg_rule_len(bytecode + i)) {
+        switch (bytecode[i] & 0x1F) {
+            default:
+                break;
+            case RULE_ARGUMENT:
+            case RULE_CONSTANT:
+            case RULE_REPLACE:
+            case RULE_MATCHTIME:
+            case RULE_ERROR:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static JanetPeg *peg_getpeg(const Janet *argv, int32_t n) {
+    if (janet_checktype(argv[n], JANET_ABSTRACT) &&
+            janet_abstract_type(janet_unwrap_abstract(argv[n])) == &janet_peg_type) {
+        return janet_unwrap_abstract(argv[n]);
+    }
+    return compile_peg_cached(argv[n]);
+}
+
+static int32_t peg_parallel_count(JanetPeg *peg, JanetByteView text, const Janet *argv, int32_t argc, int32_t n) {
+    int32_t count = janet_optnat(argv, argc, n, 0);
+    if (count == 0) count = janet_cpu_count();
+    if (count > text.len / PEG_PARALLEL_MIN_CHUNK) count = text.len / PEG_PARALLEL_MIN_CHUNK;
+#ifndef PEG_PARALLEL
+    count = 1;
+#endif
+    if (count < 1 || !peg_parallel_safe(peg)) count = 1;
+    return count;
+}
+
+static void peg_workers_free(PegWorker *workers, int32_t count) {
+    for (int32_t i = 0; i < count; i++) {
+        janet_free(workers[i].results);
+        janet_free(workers[i].error);
+    }
+    janet_sfree(workers);
+}
+
+/* Split text at bounds into count pieces and, if there is more than one,
+ * scan each on its own thread and wait for them. Pieces that could not
+ * get a thread are left for the caller. */
+static PegWorker *peg_workers_run(JanetPeg *peg, JanetByteView text, const int32_t *bounds,
+                                  int32_t count, int replace) {
+    PegWorker *workers = janet_smalloc(count * sizeof(PegWorker));
+    for (int32_t i = 0; i < count; i++) {
+        PegWorker *w = workers + i;
+        w->peg = peg;
+        w->text = text.bytes;
+        w->len = text.len;
+        w->from = bounds[i];
+        w->to = bounds[i + 1];
+        w->replace = replace;
+        w->once = 0;
+        w->done = 0;
+        w->results = NULL;
+        w->count = 0;
+        w->capacity = 0;
+        w->next = w->from;
+        w->error = NULL;
+    }
+#ifdef PEG_PARALLEL
+    if (count > 1) {
+        int *started = janet_smalloc(count * sizeof(int));
+        for (int32_t i = 0; i < count; i++) {
+#ifdef JANET_WINDOWS
+            workers[i].thread = CreateThread(NULL, 0, peg_worker_body, workers + i, 0, NULL);
+            started[i] = NULL != workers[i].thread;
+#else
+            started[i] = 0 == pthread_create(&workers[i].thread, NULL, peg_worker_body, workers + i);
+#endif
+        }
+        for (int32_t i = 0; i < count; i++) {
+            if (!started[i]) continue;
+#ifdef JANET_WINDOWS
+            WaitForSingleObject(workers[i].thread, INFINITE);
+            CloseHandle(workers[i].thread);
+#else
+            pthread_join(workers[i].thread, NULL);
+#endif
+        }
+        janet_sfree(started);
+        for (int32_t i = 0; i < count; i++) {
+            if (NULL != workers[i].error) {
+                Janet message = janet_cstringv(workers[i].error);
+                peg_workers_free(workers, count);
+                janet_panicv(message);
+            }
+        }
+    }
+#endif
+    return workers;
+}
+
+/* Scan a piece on the calling thread, starting at from. If workers is NULL,
+ * w is not part of a set of workers. */
+static void peg_worker_rescan(PegWorker *workers, int32_t count, PegWorker *w, int32_t from) {
+    w->count = 0;
+    w->from = from;
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (JANET_SIGNAL_OK == signal) {
+        peg_worker_scan(w, 0);
+    }
+    janet_restore(&tstate);
+    if (JANET_SIGNAL_OK != signal) {
+        if (NULL == workers) {
+            janet_free(w->results);
+        } else {
+            peg_workers_free(workers, count);
+        }
+        janet_panicv(tstate.payload);
+    }
+}
+
+JANET_CORE_FN(cfun_peg_find_all_parallel,
+              "(peg/find-all-parallel peg text &opt workers)",
+              "Like `peg/find-all`, but splits large texts into pieces that are searched on separate threads, "
+              "using up to `workers` threads (defaults to the number of CPUs). The result is always the same "
+              "as from `peg/find-all`. Pegs that use `cmt`, `/`, `constant`, `argument` or `error` are "
+              "matched on the current thread, as are texts too small to be worth splitting.") {
+    janet_arity(argc, 2, 3);
+    JanetPeg *peg = peg_getpeg(argv, 0);
+    JanetByteView text = janet_getbytes(argv, 1);
+    int32_t count = peg_parallel_count(peg, text, argv, argc, 2);
+    int32_t *bounds = janet_smalloc((count + 1) * sizeof(int32_t));
+    for (int32_t i = 0; i <= count; i++) {
+        bounds[i] = (int32_t)(((int64_t) text.len * i) / count);
+    }
+    PegWorker *workers = peg_workers_run(peg, text, bounds, count, 0);
+    janet_sfree(bounds);
+    JanetArray *ret = janet_array(0);
+    for (int32_t i = 0; i < count; i++) {
+        PegWorker *w = workers + i;
+        if (!w->done) peg_worker_rescan(workers, count, w, w->from);
+        for (int32_t j = 0; j < w->count; j++) {
+            janet_array_push(ret, janet_wrap_integer(w->results[j]));
+        }
+    }
+    peg_workers_free(workers, count);
+    return janet_wrap_array(ret);
+}
+
+JANET_CORE_FN(cfun_peg_replace_all_parallel,
+              "(peg/replace-all-parallel peg repl text &opt workers delimiter)",
+              "Like `peg/replace-all`, but splits large texts into pieces that are searched on separate "
+              "threads, using up to `workers` threads (defaults to the number of CPUs). Pieces end just "
+              "after a match of the peg `delimiter`, which defaults to \"\\n\". Where a match runs into the "
+              "next piece, the rest of that piece is searched again on the current thread, so the result "
+              "is always the same as from `peg/replace-all`, but is fastest when matches do not cross "
+              "delimiters. Pegs that use `cmt`, `/`, `constant`, `argument` or `error` are matched on the "
+              "current thread, as are texts too small to be worth splitting.") {
+    janet_arity(argc, 3, 5);
+    JanetPeg *peg = peg_getpeg(argv, 0);
+    JanetByteView repl = janet_getbytes(argv, 1);
+    JanetByteView text = janet_getbytes(argv, 2);
+    int32_t count = peg_parallel_count(peg, text, argv, argc, 3);
+    int32_t *bounds = janet_smalloc((count + 1) * sizeof(int32_t));
+    bounds[0] = 0;
+    bounds[count] = text.len;
+    if (count > 1) {
+        Janet delimiter = janet_cstringv("\n");
+        if (argc > 4 && !janet_checktype(argv[4], JANET_NIL)) delimiter = argv[4];
+        PegWorker d;
+        memset(&d, 0, sizeof(d));
+        d.peg = peg_getpeg(&delimiter, 0);
+        d.text = text.bytes;
+        d.len = text.len;
+        d.to = text.len;
+        d.replace = 1;
+        d.once = 1;
+        for (int32_t i = 1; i < count; i++) {
+            int32_t target = (int32_t)(((int64_t) text.len * i) / count);
+            if (target < bounds[i - 1]) target = bounds[i - 1];
+            peg_worker_rescan(NULL, 0, &d, target);
+            bounds[i] = (d.count > 0) ? d.results[1] : text.len;
+        }
+        janet_free(d.results);
+    }
+    PegWorker *workers = peg_workers_run(peg, text, bounds, count, 1);
+    janet_sfree(bounds);
+    JanetBuffer *ret = janet_buffer(text.len);
+    int32_t trail = 0;
+    int32_t cursor = 0;
+    for (int32_t i = 0; i < count; i++) {
+        PegWorker *w = workers + i;
+        /* Pick up where the previous piece stopped if it was not where this piece started */
+        if (!w->done || cursor != w->from) {
+            peg_worker_rescan(workers, count, w, cursor > w->from ? cursor : w->from);
+        }
+        for (int32_t j = 0; j < w->count; j += 2) {
+            int32_t start = w->results[j];
+            if (trail < start) {
+                janet_buffer_push_bytes(ret, text.bytes + trail, start - trail);
+            }
+            janet_buffer_push_bytes(ret, repl.bytes, repl.len);
+            trail = w->results[j + 1];
+        }
+        cursor = w->next;
+    }
+    if (trail < text.len) {
+        janet_buffer_push_bytes(ret, text.bytes + trail, text.len - trail);
+    }
+    peg_workers_free(workers, count);
+    return janet_wrap_buffer(ret);
+}
+
+/*
+ * Streams
+ */
+
+/* Match a peg against input that arrives in chunks */
+typedef struct {
+    JanetPeg *peg;
+    JanetBuffer *buffer; /* Input that has not been consumed yet */
+    const Janet *extrav;
+    int32_t extrac;
+    int finished;
+    int stopped;
+} PegStream;
+
+static int peg_stream_mark(void *p, size_t size) {
+    (void) size;
+    PegStream *stream = (PegStream *)p;
+    janet_mark(janet_wrap_abstract(stream->peg));
+    janet_mark(janet_wrap_buffer(stream->buffer));
+    if (NULL != stream->extrav)
+        janet_mark(janet_wrap_tuple(stream->extrav));
+    return 0;
+}
+
+static int peg_stream_getter(JanetAbstract a, Janet key, Janet *out);
+static Janet peg_stream_next(void *p, Janet key);
+
+const JanetAbstractType janet_peg_stream_type = {
+    "core/peg-stream",
+    NULL,
+    peg_stream_mark,
+    peg_stream_getter,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    peg_stream_next,
+    JANET_ATEND_NEXT
+};
+
+/* Match the peg as many times as possible from the start of the buffered input,
+ * stopping at a match that might change with more input. Consumed input is dropped. */
+static Janet peg_stream_run(PegStream *stream) {
+    if (stream->stopped) return janet_wrap_nil();
+    JanetBuffer *buffer = stream->buffer;
+    PegState s;
+    s.mode = PEG_MODE_NORMAL;
+    s.captures = janet_array(0);
+    s.tagged_captures = janet_array(0);
+    s.scratch = janet_buffer(10);
+    s.tags = janet_buffer(10);
+    s.constants = stream->peg->constants;
+    s.bytecode = stream->peg->bytecode;
+    s.first = stream->peg->first;
+    s.has_backref = stream->peg->has_backref;
+    s.memo = NULL;
+    s.memo_slots = NULL;
+    s.memo_skip = NULL;
+    s.native = NULL;
+    s.extrac = stream->extrac;
+    s.extrav = stream->extrav;
+    s.text_end = buffer->data + buffer->count;
+    s.partial = !stream->finished;
+    int32_t consumed = 0;
+    for (;;) {
+        s.text_start = buffer->data + consumed;
+        s.linemap = NULL;
+        s.linemaplen = -1;
+        s.depth = JANET_RECURSION_GUARD;
+        s.hit_end = 0;
+        s.scratch->count = 0;
+        s.tags->count = 0;
+        s.tagged_captures->count = 0;
+        CapState cs = cap_save(&s);
+        const uint8_t *result = peg_rule(&s, s.bytecode, s.text_start);
+        if (s.hit_end && !stream->finished) {
+            /* Wait for more input */
+            cap_load(&s, cs);
+            break;
+        }
+        if (NULL == result || result == s.text_start) {
+            cap_load(&s, cs);
+            /* Running out of input at the end of a match is not a failure */
+            stream->stopped = !stream->finished || s.text_start < s.text_end;
+            break;
+        }
+        consumed = (int32_t)(result - buffer->data);
+    }
+    if (consumed > 0) {
+        memmove(buffer->data, buffer->data + consumed, buffer->count - consumed);
+        buffer->count -= consumed;
+    }
+    if (stream->stopped && s.captures->count == 0) return janet_wrap_nil();
+    return janet_wrap_array(s.captures);
+}
+
+static PegStream *peg_getstream(const Janet *argv, int32_t n) {
+    PegStream *stream = janet_getabstract(argv, n, &janet_peg_stream_type);
+    if (stream->finished) janet_panic("peg stream is finished");
+    return stream;
+}
+
+JANET_CORE_FN(cfun_peg_stream,
+              "(peg/stream peg & args)",
+              "Create a stream that matches peg repeatedly against input that is fed to it in chunks, "
+              "such as the results of `file/read` or `net/read`. This is like matching `(any peg)` "
+              "against the whole input, but only the input for the current match is kept in memory. "
+              "Each match is made as if the text started where the match starts, so `(position)`, "
+              "`(line)` and `(column)` captures are relative to the start of the match and look-behind "
+              "cannot see earlier matches. A match that reaches the end of the input so far is run "
+              "again from its start when more input is fed, so functions in `cmt` and `/` rules "
+              "may be called several times for one match. `args` are passed to the peg like in "
+              "`peg/match`.") {
+    janet_arity(argc, 1, -1);
+    PegStream *stream = janet_abstract(&janet_peg_stream_type, sizeof(PegStream));
+    stream->peg = NULL;
+    stream->buffer = janet_buffer(0);
+    stream->extrac = argc - 1;
+    stream->extrav = argc > 1 ? janet_tuple_n(argv + 1, argc - 1) : NULL;
+    stream->finished = 0;
+    stream->stopped = 0;
+    if (janet_checktype(argv[0], JANET_ABSTRACT) &&
+            janet_abstract_type(janet_unwrap_abstract(argv[0])) == &janet_peg_type) {
+        stream->peg = janet_unwrap_abstract(argv[0]);
+    } else {
+        stream->peg = compile_peg_cached(argv[0]);
+    }
+    return janet_wrap_abstract(stream);
+}
+
+JANET_CORE_FN(cfun_peg_feed,
+              "(peg/feed stream bytes)",
+              "Add bytes to the input of a peg stream, and return an array of the captures "
+              "of every match that is now complete. A match that reaches the end of the input so far "
+              "is not complete until more input shows it would not change. Once the peg no longer "
+              "matches and all captures have been returned, returns nil.") {
+    janet_fixarity(argc, 2);
+    PegStream *stream = peg_getstream(argv, 0);
+    JanetByteView bytes = janet_getbytes(argv, 1);
+    if (!stream->stopped) janet_buffer_push_bytes(stream->buffer, bytes.bytes, bytes.len);
+    return peg_stream_run(stream);
+}
+
+JANET_CORE_FN(cfun_peg_finish,
+              "(peg/finish stream)",
+              "Mark the end of the input of a peg stream, and return an array of the captures "
+              "of the remaining matches. Returns nil if the peg stopped matching before the end of "
+              "the input and all captures have been returned. The stream cannot be used after this.") {
+    janet_fixarity(argc, 1);
+    PegStream *stream = peg_getstream(argv, 0);
+    stream->finished = 1;
+    Janet ret = peg_stream_run(stream);
+    stream->buffer->count = 0;
+    return ret;
+}
+
+static JanetMethod peg_stream_methods[] = {
+    {"feed", cfun_peg_feed},
+    {"finish", cfun_peg_finish},
+    {NULL, NULL}
+};
+
+static int peg_stream_getter(JanetAbstract a, Janet key, Janet *out) {
+    (void) a;
+    if (!janet_checktype(key, JANET_KEYWORD))
+        return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), peg_stream_methods, out);
+}
+
+static Janet peg_stream_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(peg_stream_methods, key);
+}
+
 static JanetMethod peg_methods[] = {
     {"match", cfun_peg_match},
     {"find", cfun_peg_find},
@@ -1791,11 +3890,17 @@ static Janet peg_next(void *p, Janet key) {
 void janet_lib_peg(JanetTable *env) {
     JanetRegExt cfuns[] = {
         JANET_CORE_REG("peg/compile", cfun_peg_compile),
+        JANET_CORE_REG("peg/memo-stats", cfun_peg_memo_stats),
         JANET_CORE_REG("peg/match", cfun_peg_match),
         JANET_CORE_REG("peg/find", cfun_peg_find),
         JANET_CORE_REG("peg/find-all", cfun_peg_find_all),
         JANET_CORE_REG("peg/replace", cfun_peg_replace),
         JANET_CORE_REG("peg/replace-all", cfun_peg_replace_all),
+        JANET_CORE_REG("peg/find-all-parallel", cfun_peg_find_all_parallel),
+        JANET_CORE_REG("peg/replace-all-parallel", cfun_peg_replace_all_parallel),
+        JANET_CORE_REG("peg/stream", cfun_peg_stream),
+        JANET_CORE_REG("peg/feed", cfun_peg_feed),
+        JANET_CORE_REG("peg/finish", cfun_peg_finish),
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, cfuns);
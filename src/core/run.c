@@ -123,9 +123,12 @@ int janet_dostring(JanetTable *env, const char *str, const char *sourcePath, Jan
 int janet_loop_fiber(JanetFiber *fiber) {
     int status;
 #ifdef JANET_EV
+    /* Keep the fiber alive so its status can be checked after the loop */
+    janet_gcroot(janet_wrap_fiber(fiber));
     janet_schedule(fiber, janet_wrap_nil());
     janet_loop();
     status = janet_fiber_status(fiber);
+    janet_gcunroot(janet_wrap_fiber(fiber));
 #else
     Janet out;
     status = janet_continue(fiber, janet_wrap_nil(), &out);
@@ -60,6 +60,19 @@ typedef struct {
     int is_error;
 } JanetTimeout;
 
+#ifdef JANET_PEG
+/* Number of slots in the compiled peg cache. Must be a power of 2. */
+#define JANET_PEG_CACHE_SIZE 64
+
+/* A grammar compiled by peg/match and friends. The key is not
+ * marked by the gc - entries are dropped when the key is collected. */
+typedef struct {
+    Janet key;
+    void *peg;
+    const JanetKV *deps; /* Rules that were resolved in (dyn :peg-grammar) */
+} JanetPegCacheEntry;
+#endif
+
 /* Registry table for C functions - containts metadata that can
  * be looked up by cfunction pointer. All strings here are pointing to
  * static memory not managed by Janet. */
@@ -125,6 +138,23 @@ struct JanetVM {
     size_t block_count;
     int gc_suspend;
 
+    /* Statistics since the VM started */
+    size_t gc_allocations;
+    size_t gc_collections;
+    uint64_t gc_allocated; /* Bytes allocated before the last collection */
+
+#ifdef JANET_PEG
+    /* Compiled pegs for grammars passed as data */
+    JanetPegCacheEntry peg_cache[JANET_PEG_CACHE_SIZE];
+#endif
+
+    /* All string views, so the gc can copy small views out of large strings */
+    JanetStringView *string_views;
+
+    /* Pool of dead fibers, linked through the gc header */
+    JanetFiber *fiber_pool;
+    size_t fiber_pool_count;
+
     /* GC roots */
     Janet *roots;
     size_t root_count;
@@ -39,17 +39,26 @@ uint8_t *janet_string_begin(int32_t length) {
     return data;
 }
 
-/* Finish building a string */
+/* Finish building a string. The hash is computed the first time it is needed. */
 const uint8_t *janet_string_end(uint8_t *str) {
-    janet_string_hash(str) = janet_string_calchash(str, janet_string_length(str));
+    janet_string_head(str)->hash = 0;
     return str;
 }
 
+/* Compute the hash of a string that does not have one yet */
+int32_t janet_string_sethash(const uint8_t *str) {
+    JanetStringHead *head = janet_string_head(str);
+    int32_t hash = janet_string_calchash(str, head->length);
+    /* Static strings may be in read only memory */
+    if (!(head->gc.flags & JANET_MEM_STATIC)) head->hash = hash;
+    return hash;
+}
+
 /* Load a buffer as a string */
 const uint8_t *janet_string(const uint8_t *buf, int32_t len) {
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_STRING, sizeof(JanetStringHead) + (size_t) len + 1);
     head->length = len;
-    head->hash = janet_string_calchash(buf, len);
+    head->hash = 0;
     uint8_t *data = (uint8_t *)head->data;
     safe_memcpy(data, buf, len);
     data[len] = 0;
@@ -67,13 +76,14 @@ int janet_string_compare(const uint8_t *lhs, const uint8_t *rhs) {
     return xlen < ylen ? -1 : 1;
 }
 
-/* Compare a janet string with a piece of memory */
+/* Compare a janet string with a piece of memory. A hash of 0 is not known
+ * and is not compared. */
 int janet_string_equalconst(const uint8_t *lhs, const uint8_t *rhs, int32_t rlen, int32_t rhash) {
-    int32_t lhash = janet_string_hash(lhs);
+    int32_t lhash = janet_string_head(lhs)->hash;
     int32_t llen = janet_string_length(lhs);
     if (lhs == rhs)
         return 1;
-    if (lhash != rhash || llen != rlen)
+    if (llen != rlen || (lhash && rhash && lhash != rhash))
         return 0;
     return !memcmp(lhs, rhs, rlen);
 }
@@ -81,7 +91,7 @@ int janet_string_equalconst(const uint8_t *lhs, const uint8_t *rhs, int32_t rlen
 /* Check if two strings are equal */
 int janet_string_equal(const uint8_t *lhs, const uint8_t *rhs) {
     return janet_string_equalconst(lhs, rhs,
-                                   janet_string_length(rhs), janet_string_hash(rhs));
+                                   janet_string_length(rhs), janet_string_head(rhs)->hash);
 }
 
 /* Load a c string */
@@ -89,83 +99,407 @@ const uint8_t *janet_cstring(const char *str) {
     return janet_string((const uint8_t *)str, (int32_t)strlen(str));
 }
 
-/* Knuth Morris Pratt Algorithm */
+/* String views */
+
+/* Once nothing else references a string, its views are copied into their
+ * own strings if together they cover less than 1/JANET_STRING_VIEW_SHARE of it */
+#define JANET_STRING_VIEW_SHARE 4
+
+static void string_view_link(JanetStringView *view) {
+    view->next = janet_vm.string_views;
+    janet_vm.string_views = view;
+}
+
+static int string_view_get(void *p, Janet key, Janet *out) {
+    JanetStringView *view = (JanetStringView *) p;
+    if (!janet_checkint(key)) return 0;
+    int32_t index = janet_unwrap_integer(key);
+    if (index < 0 || index >= view->length) return 0;
+    *out = janet_wrap_integer(view->bytes[index]);
+    return 1;
+}
+
+static void string_view_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetStringView *view = (JanetStringView *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int(ctx, view->length);
+    janet_marshal_bytes(ctx, view->bytes, view->length);
+}
+
+static void *string_view_unmarshal(JanetMarshalContext *ctx) {
+    int32_t length = janet_unmarshal_int(ctx);
+    if (length < 0) janet_panic("invalid string view");
+    uint8_t *str = janet_string_begin(length);
+    janet_unmarshal_bytes(ctx, str, (size_t) length);
+    JanetStringView *view = janet_unmarshal_abstract(ctx, sizeof(JanetStringView));
+    view->parent = view->bytes = janet_string_end(str);
+    view->length = length;
+    string_view_link(view);
+    return view;
+}
+
+static void string_view_tostring(void *p, JanetBuffer *buffer) {
+    JanetStringView *view = (JanetStringView *) p;
+    janet_buffer_push_bytes(buffer, view->bytes, view->length);
+}
+
+static int string_view_compare(void *lhs, void *rhs) {
+    JanetStringView *x = (JanetStringView *) lhs;
+    JanetStringView *y = (JanetStringView *) rhs;
+    int32_t len = x->length > y->length ? y->length : x->length;
+    int res = memcmp(x->bytes, y->bytes, len);
+    if (res) return res > 0 ? 1 : -1;
+    if (x->length == y->length) return 0;
+    return x->length < y->length ? -1 : 1;
+}
+
+static int32_t string_view_hash(void *p, size_t len) {
+    (void) len;
+    JanetStringView *view = (JanetStringView *) p;
+    return janet_string_calchash(view->bytes, view->length);
+}
+
+static Janet string_view_next(void *p, Janet key) {
+    JanetStringView *view = (JanetStringView *) p;
+    int32_t i;
+    if (janet_checktype(key, JANET_NIL)) {
+        i = 0;
+    } else if (janet_checkint(key)) {
+        i = janet_unwrap_integer(key) + 1;
+    } else {
+        return janet_wrap_nil();
+    }
+    return (i >= 0 && i < view->length) ? janet_wrap_integer(i) : janet_wrap_nil();
+}
+
+static size_t string_view_length(void *p, size_t len) {
+    (void) len;
+    return (size_t)((JanetStringView *) p)->length;
+}
+
+static JanetByteView string_view_bytes(void *p, size_t len) {
+    (void) len;
+    JanetStringView *view = (JanetStringView *) p;
+    JanetByteView bytes;
+    bytes.bytes = view->bytes;
+    bytes.len = view->length;
+    return bytes;
+}
+
+const JanetAbstractType janet_string_view_type = {
+    "core/string-view",
+    NULL,
+    NULL,
+    string_view_get,
+    NULL,
+    string_view_marshal,
+    string_view_unmarshal,
+    string_view_tostring,
+    string_view_compare,
+    string_view_hash,
+    string_view_next,
+    NULL,
+    string_view_length,
+    string_view_bytes
+};
+
+/* Make a view of the bytes from start to end of a string, symbol, keyword
+ * or string view. Views of views share the original string. */
+Janet janet_string_view(Janet str, int32_t start, int32_t end) {
+    const uint8_t *parent, *bytes;
+    int32_t length;
+    JanetStringView *from = janet_checkabstract(str, &janet_string_view_type);
+    if (from) {
+        parent = from->parent;
+        bytes = from->bytes;
+        length = from->length;
+    } else if (janet_checktypes(str, JANET_TFLAG_STRING | JANET_TFLAG_SYMBOL | JANET_TFLAG_KEYWORD)) {
+        parent = bytes = janet_unwrap_string(str);
+        length = janet_string_length(parent);
+    } else {
+        janet_panicf("expected string or string view, got %v", str);
+    }
+    if (start < 0 || end < start || end > length) {
+        janet_panicf("range [%d, %d) out of bounds for string view of length %d", start, end, length);
+    }
+    JanetStringView *view = janet_abstract(&janet_string_view_type, sizeof(JanetStringView));
+    view->parent = parent;
+    view->bytes = bytes + start;
+    view->length = end - start;
+    string_view_link(view);
+    return janet_wrap_abstract(view);
+}
+
+typedef struct {
+    const uint8_t *parent;
+    int64_t covered;
+} StringViewShare;
+
+/* A view whose parent string is not otherwise reachable */
+static int string_view_pending(JanetStringView *view) {
+    JanetStringHead *head = janet_string_head(view->parent);
+    return !(head->gc.flags & JANET_MEM_STATIC) && !janet_gc_reachable(head);
+}
 
-struct kmp_state {
+static StringViewShare *string_view_share(StringViewShare *shares, size_t cap, const uint8_t *parent) {
+    size_t i = (size_t)(((uintptr_t) parent >> 4) * 2654435761u) & (cap - 1);
+    while (shares[i].parent && shares[i].parent != parent) {
+        i = (i + 1) & (cap - 1);
+    }
+    shares[i].parent = parent;
+    return shares + i;
+}
+
+/* Called by the gc after marking everything else. Views do not mark their
+ * parent strings, so that a few short views do not keep a large string
+ * alive. Such views are copied into new strings instead. Views that are
+ * about to be collected are dropped from the list of views. */
+void janet_string_views_mark(void) {
+    JanetStringView *view, **link = &janet_vm.string_views;
+    size_t count = 0, cap = 16;
+    while ((view = *link)) {
+        if (!janet_gc_reachable(janet_abstract_head(view))) {
+            *link = view->next;
+            continue;
+        }
+        if (string_view_pending(view)) count++;
+        link = &view->next;
+    }
+    if (!count) return;
+    while (cap < 2 * count) cap <<= 1;
+    /* Without the shares, keep every parent alive */
+    StringViewShare *shares = janet_calloc(cap, sizeof(StringViewShare));
+    if (shares) {
+        for (view = janet_vm.string_views; view; view = view->next) {
+            if (string_view_pending(view)) {
+                string_view_share(shares, cap, view->parent)->covered += view->length;
+            }
+        }
+    }
+    for (view = janet_vm.string_views; view; view = view->next) {
+        if (!string_view_pending(view)) continue;
+        JanetStringHead *head = janet_string_head(view->parent);
+        if (shares &&
+                string_view_share(shares, cap, view->parent)->covered * JANET_STRING_VIEW_SHARE < head->length) {
+            const uint8_t *copy = janet_string(view->bytes, view->length);
+            janet_gc_mark(janet_string_head(copy));
+            view->parent = view->bytes = copy;
+        } else {
+            janet_gc_mark(head);
+        }
+    }
+    janet_free(shares);
+}
+
+/* Substring search. Single bytes use memchr, short patterns are found by
+ * filtering on their first and last bytes, and long patterns use the
+ * Two-Way algorithm. None of them allocate. */
+
+#define JANET_FIND_SHORT 32
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define JANET_FIND_SSE2
+#include <emmintrin.h>
+#endif
+
+struct find_state {
     int32_t i;
-    int32_t j;
     int32_t textlen;
     int32_t patlen;
-    int32_t *lookup;
     const uint8_t *text;
     const uint8_t *pat;
+    /* Two-Way tables, only set for long patterns */
+    int32_t ms;
+    int32_t period;
+    int32_t mem0;
+    uint32_t byteset[8];
+    int32_t shift[256];
 };
 
-static void kmp_init(
-    struct kmp_state *s,
+/*
+  The Two-Way setup and search follow musl's memmem, which is MIT licensed:
+
+  https://git.musl-libc.org/cgit/musl/tree/src/string/memmem.c
+*/
+static void find_twoway_init(struct find_state *s) {
+    const uint8_t *n = s->pat;
+    int32_t l = s->patlen;
+    int32_t i, ip, jp, k, p, ms, p0;
+    memset(s->byteset, 0, sizeof(s->byteset));
+    for (i = 0; i < l; i++) {
+        s->byteset[n[i] >> 5] |= (uint32_t) 1 << (n[i] & 31);
+        s->shift[n[i]] = i + 1;
+    }
+    /* Compute maximal suffix */
+    ip = -1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] > n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+    /* And with the opposite comparison */
+    ip = -1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] < n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    if (ip > ms) {
+        ms = ip;
+    } else {
+        p = p0;
+    }
+    /* Periodic pattern? */
+    if (memcmp(n, n + p, (size_t)(ms + 1))) {
+        s->mem0 = 0;
+        s->period = (ms > l - ms - 1 ? ms : l - ms - 1) + 1;
+    } else {
+        s->mem0 = l - p;
+        s->period = p;
+    }
+    s->ms = ms;
+}
+
+static int32_t find_twoway(const struct find_state *s, int32_t from) {
+    const uint8_t *n = s->pat;
+    const uint8_t *h = s->text + from;
+    const uint8_t *z = s->text + s->textlen;
+    int32_t l = s->patlen;
+    int32_t ms = s->ms;
+    int32_t mem = 0;
+    int32_t k;
+    while (z - h >= l) {
+        /* Check the last byte first and skip ahead on a mismatch */
+        uint8_t c = h[l - 1];
+        if (s->byteset[c >> 5] & ((uint32_t) 1 << (c & 31))) {
+            k = l - s->shift[c];
+            if (k) {
+                if (k < mem) k = mem;
+                h += k;
+                mem = 0;
+                continue;
+            }
+        } else {
+            h += l;
+            mem = 0;
+            continue;
+        }
+        /* Compare the right half */
+        for (k = (ms + 1 > mem ? ms + 1 : mem); k < l && n[k] == h[k]; k++);
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+        /* Compare the left half */
+        for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--);
+        if (k <= mem) return (int32_t)(h - s->text);
+        h += s->period;
+        mem = s->mem0;
+    }
+    return -1;
+}
+
+/* Find candidates where both the first and last bytes of the pattern
+ * match, then compare the rest. */
+static int32_t find_short(const struct find_state *s, int32_t from) {
+    const uint8_t *text = s->text;
+    const uint8_t *pat = s->pat;
+    int32_t last = s->patlen - 1;
+    int32_t end = s->textlen - last;
+    int32_t i = from;
+#ifdef JANET_FIND_SSE2
+    __m128i first_byte = _mm_set1_epi8((char) pat[0]);
+    __m128i last_byte = _mm_set1_epi8((char) pat[last]);
+    for (; i + 16 <= end; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(text + i + last));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(
+                            _mm_and_si128(_mm_cmpeq_epi8(a, first_byte), _mm_cmpeq_epi8(b, last_byte)));
+        while (mask) {
+            int32_t j = i + __builtin_ctz(mask);
+            if (!memcmp(text + j + 1, pat + 1, (size_t)(last - 1))) return j;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i < end) {
+        const uint8_t *p = memchr(text + i, pat[0], (size_t)(end - i));
+        if (NULL == p) return -1;
+        i = (int32_t)(p - text);
+        if (text[i + last] == pat[last] && !memcmp(text + i + 1, pat + 1, (size_t)(last - 1))) return i;
+        i++;
+    }
+    return -1;
+}
+
+static void find_init(
+    struct find_state *s,
     const uint8_t *text, int32_t textlen,
     const uint8_t *pat, int32_t patlen) {
     if (patlen == 0) {
         janet_panic("expected non-empty pattern");
     }
-    int32_t *lookup = janet_calloc(patlen, sizeof(int32_t));
-    if (!lookup) {
-        JANET_OUT_OF_MEMORY;
-    }
-    s->lookup = lookup;
     s->i = 0;
-    s->j = 0;
     s->text = text;
     s->pat = pat;
     s->textlen = textlen;
     s->patlen = patlen;
-    /* Init state machine */
-    {
-        int32_t i, j;
-        for (i = 1, j = 0; i < patlen; i++) {
-            while (j && pat[j] != pat[i]) j = lookup[j - 1];
-            if (pat[j] == pat[i]) j++;
-            lookup[i] = j;
-        }
+    if (patlen > JANET_FIND_SHORT) {
+        find_twoway_init(s);
     }
 }
 
-static void kmp_deinit(struct kmp_state *state) {
-    janet_free(state->lookup);
-}
-
-static void kmp_seti(struct kmp_state *state, int32_t i) {
+static void find_seti(struct find_state *state, int32_t i) {
     state->i = i;
-    state->j = 0;
 }
 
-static int32_t kmp_next(struct kmp_state *state) {
+/* Find the next match at or after state->i. Matches may overlap. */
+static int32_t find_next(struct find_state *state) {
     int32_t i = state->i;
-    int32_t j = state->j;
-    int32_t textlen = state->textlen;
-    int32_t patlen = state->patlen;
-    const uint8_t *text = state->text;
-    const uint8_t *pat = state->pat;
-    int32_t *lookup = state->lookup;
-    while (i < textlen) {
-        if (text[i] == pat[j]) {
-            if (j == patlen - 1) {
-                state->i = i + 1;
-                state->j = lookup[j];
-                return i - j;
-            } else {
-                i++;
-                j++;
-            }
-        } else {
-            if (j > 0) {
-                j = lookup[j - 1];
-            } else {
-                i++;
-            }
-        }
+    int32_t result;
+    if (i > state->textlen - state->patlen) {
+        return -1;
+    } else if (state->patlen == 1) {
+        const uint8_t *p = memchr(state->text + i, state->pat[0], (size_t)(state->textlen - i));
+        result = p ? (int32_t)(p - state->text) : -1;
+    } else if (state->patlen <= JANET_FIND_SHORT) {
+        result = find_short(state, i);
+    } else {
+        result = find_twoway(state, i);
     }
-    return -1;
+    if (result >= 0) state->i = result + 1;
+    return result;
 }
 
 /* CFuns */
@@ -182,6 +516,20 @@ JANET_CORE_FN(cfun_string_slice,
     return janet_stringv(view.bytes + range.start, range.end - range.start);
 }
 
+JANET_CORE_FN(cfun_string_view,
+              "(string/view str &opt start end)",
+              "Returns a string view of `str` from index `start` inclusive to index `end`, "
+              "exclusive, indexed as in `string/slice`. A view shares the bytes of `str` "
+              "instead of copying them, and can be used anywhere a byte sequence is expected. "
+              "`str` can be a string, symbol, keyword or string view. Other functions, such as "
+              "`string/slice`, return strings even when given a view. A view is not a string, "
+              "so it is not equal to a string with the same bytes, and is a different table "
+              "key. Use `string` to copy a view into a new string.") {
+    janet_getbytes(argv, 0);
+    JanetRange range = janet_getslice(argc, argv);
+    return janet_string_view(argv[0], range.start, range.end);
+}
+
 JANET_CORE_FN(cfun_symbol_slice,
               "(symbol/slice bytes &opt start end)",
               "Same as string/slice, but returns a symbol.") {
@@ -250,14 +598,7 @@ JANET_CORE_FN(cfun_string_asciilower,
     janet_fixarity(argc, 1);
     JanetByteView view = janet_getbytes(argv, 0);
     uint8_t *buf = janet_string_begin(view.len);
-    for (int32_t i = 0; i < view.len; i++) {
-        uint8_t c = view.bytes[i];
-        if (c >= 65 && c <= 90) {
-            buf[i] = c + 32;
-        } else {
-            buf[i] = c;
-        }
-    }
+    janet_ascii_lower(buf, view.bytes, view.len);
     return janet_wrap_string(janet_string_end(buf));
 }
 
@@ -269,14 +610,7 @@ JANET_CORE_FN(cfun_string_asciiupper,
     janet_fixarity(argc, 1);
     JanetByteView view = janet_getbytes(argv, 0);
     uint8_t *buf = janet_string_begin(view.len);
-    for (int32_t i = 0; i < view.len; i++) {
-        uint8_t c = view.bytes[i];
-        if (c >= 97 && c <= 122) {
-            buf[i] = c - 32;
-        } else {
-            buf[i] = c;
-        }
-    }
+    janet_ascii_upper(buf, view.bytes, view.len);
     return janet_wrap_string(janet_string_end(buf));
 }
 
@@ -286,14 +620,11 @@ JANET_CORE_FN(cfun_string_reverse,
     janet_fixarity(argc, 1);
     JanetByteView view = janet_getbytes(argv, 0);
     uint8_t *buf = janet_string_begin(view.len);
-    int32_t i, j;
-    for (i = 0, j = view.len - 1; i < view.len; i++, j--) {
-        buf[i] = view.bytes[j];
-    }
+    janet_bytes_reverse(buf, view.bytes, view.len);
     return janet_wrap_string(janet_string_end(buf));
 }
 
-static void findsetup(int32_t argc, Janet *argv, struct kmp_state *s, int32_t extra) {
+static void findsetup(int32_t argc, Janet *argv, struct find_state *s, int32_t extra) {
     janet_arity(argc, 2, 3 + extra);
     JanetByteView pat = janet_getbytes(argv, 0);
     JanetByteView text = janet_getbytes(argv, 1);
@@ -302,7 +633,7 @@ static void findsetup(int32_t argc, Janet *argv, struct kmp_state *s, int32_t ex
         start = janet_getinteger(argv, 2);
         if (start < 0) janet_panic("expected non-negative start index");
     }
-    kmp_init(s, text.bytes, text.len, pat.bytes, pat.len);
+    find_init(s, text.bytes, text.len, pat.bytes, pat.len);
     s->i = start;
 }
 
@@ -312,10 +643,9 @@ JANET_CORE_FN(cfun_string_find,
               "`str`. Returns the index of the first character in `patt` if found, "
               "otherwise returns nil.") {
     int32_t result;
-    struct kmp_state state;
+    struct find_state state;
     findsetup(argc, argv, &state, 0);
-    result = kmp_next(&state);
-    kmp_deinit(&state);
+    result = find_next(&state);
     return result < 0
            ? janet_wrap_nil()
            : janet_wrap_integer(result);
@@ -352,18 +682,17 @@ JANET_CORE_FN(cfun_string_findall,
               "instances of the pattern are counted individually, meaning a byte in `str` "
               "may contribute to multiple found patterns.") {
     int32_t result;
-    struct kmp_state state;
+    struct find_state state;
     findsetup(argc, argv, &state, 0);
     JanetArray *array = janet_array(0);
-    while ((result = kmp_next(&state)) >= 0) {
+    while ((result = find_next(&state)) >= 0) {
         janet_array_push(array, janet_wrap_integer(result));
     }
-    kmp_deinit(&state);
     return janet_wrap_array(array);
 }
 
 struct replace_state {
-    struct kmp_state kmp;
+    struct find_state find;
     const uint8_t *subst;
     int32_t substlen;
 };
@@ -378,8 +707,8 @@ static void replacesetup(int32_t argc, Janet *argv, struct replace_state *s) {
         start = janet_getinteger(argv, 3);
         if (start < 0) janet_panic("expected non-negative start index");
     }
-    kmp_init(&s->kmp, text.bytes, text.len, pat.bytes, pat.len);
-    s->kmp.i = start;
+    find_init(&s->find, text.bytes, text.len, pat.bytes, pat.len);
+    s->find.i = start;
     s->subst = subst.bytes;
     s->substlen = subst.len;
 }
@@ -392,18 +721,16 @@ JANET_CORE_FN(cfun_string_replace,
     struct replace_state s;
     uint8_t *buf;
     replacesetup(argc, argv, &s);
-    result = kmp_next(&s.kmp);
+    result = find_next(&s.find);
     if (result < 0) {
-        kmp_deinit(&s.kmp);
-        return janet_stringv(s.kmp.text, s.kmp.textlen);
+        return janet_stringv(s.find.text, s.find.textlen);
     }
-    buf = janet_string_begin(s.kmp.textlen - s.kmp.patlen + s.substlen);
-    safe_memcpy(buf, s.kmp.text, result);
+    buf = janet_string_begin(s.find.textlen - s.find.patlen + s.substlen);
+    safe_memcpy(buf, s.find.text, result);
     safe_memcpy(buf + result, s.subst, s.substlen);
     safe_memcpy(buf + result + s.substlen,
-                s.kmp.text + result + s.kmp.patlen,
-                s.kmp.textlen - result - s.kmp.patlen);
-    kmp_deinit(&s.kmp);
+                s.find.text + result + s.find.patlen,
+                s.find.textlen - result - s.find.patlen);
     return janet_wrap_string(janet_string_end(buf));
 }
 
@@ -417,17 +744,16 @@ JANET_CORE_FN(cfun_string_replaceall,
     JanetBuffer b;
     int32_t lastindex = 0;
     replacesetup(argc, argv, &s);
-    janet_buffer_init(&b, s.kmp.textlen);
-    while ((result = kmp_next(&s.kmp)) >= 0) {
-        janet_buffer_push_bytes(&b, s.kmp.text + lastindex, result - lastindex);
+    janet_buffer_init(&b, s.find.textlen);
+    while ((result = find_next(&s.find)) >= 0) {
+        janet_buffer_push_bytes(&b, s.find.text + lastindex, result - lastindex);
         janet_buffer_push_bytes(&b, s.subst, s.substlen);
-        lastindex = result + s.kmp.patlen;
-        kmp_seti(&s.kmp, lastindex);
+        lastindex = result + s.find.patlen;
+        find_seti(&s.find, lastindex);
     }
-    janet_buffer_push_bytes(&b, s.kmp.text + lastindex, s.kmp.textlen - lastindex);
+    janet_buffer_push_bytes(&b, s.find.text + lastindex, s.find.textlen - lastindex);
     const uint8_t *ret = janet_string(b.data, b.count);
     janet_buffer_deinit(&b);
-    kmp_deinit(&s.kmp);
     return janet_wrap_string(ret);
 }
 
@@ -440,25 +766,33 @@ JANET_CORE_FN(cfun_string_split,
               "of `limit` results (if provided).") {
     int32_t result;
     JanetArray *array;
-    struct kmp_state state;
+    struct find_state state;
     int32_t limit = -1, lastindex = 0;
     if (argc == 4) {
         limit = janet_getinteger(argv, 3);
     }
     findsetup(argc, argv, &state, 1);
     array = janet_array(0);
-    while ((result = kmp_next(&state)) >= 0 && --limit) {
+    while ((result = find_next(&state)) >= 0 && --limit) {
         const uint8_t *slice = janet_string(state.text + lastindex, result - lastindex);
         janet_array_push(array, janet_wrap_string(slice));
         lastindex = result + state.patlen;
-        kmp_seti(&state, lastindex);
+        find_seti(&state, lastindex);
     }
     const uint8_t *slice = janet_string(state.text + lastindex, state.textlen - lastindex);
     janet_array_push(array, janet_wrap_string(slice));
-    kmp_deinit(&state);
     return janet_wrap_array(array);
 }
 
+JANET_CORE_FN(cfun_string_utf8valid,
+              "(string/utf8-valid? str)",
+              "Checks that the byte sequence `str` is valid UTF-8 as defined by RFC 3629. "
+              "Overlong encodings, surrogates and code points past U+10FFFF are invalid.") {
+    janet_fixarity(argc, 1);
+    JanetByteView str = janet_getbytes(argv, 0);
+    return janet_wrap_boolean(janet_valid_utf8_strict(str.bytes, str.len));
+}
+
 JANET_CORE_FN(cfun_string_checkset,
               "(string/check-set set str)",
               "Checks that the string `str` only contains bytes that appear in the string `set`. "
@@ -475,14 +809,7 @@ JANET_CORE_FN(cfun_string_checkset,
         bitset[index] |= mask;
     }
     /* Check set */
-    for (int32_t i = 0; i < str.len; i++) {
-        int index = str.bytes[i] >> 5;
-        uint32_t mask = 1 << (str.bytes[i] & 0x1F);
-        if (!(bitset[index] & mask)) {
-            return janet_wrap_false();
-        }
-    }
-    return janet_wrap_true();
+    return janet_wrap_boolean(janet_bytes_in_set(str.bytes, str.len, bitset));
 }
 
 JANET_CORE_FN(cfun_string_join,
@@ -608,6 +935,7 @@ JANET_CORE_FN(cfun_string_trimr,
 void janet_lib_string(JanetTable *env) {
     JanetRegExt string_cfuns[] = {
         JANET_CORE_REG("string/slice", cfun_string_slice),
+        JANET_CORE_REG("string/view", cfun_string_view),
         JANET_CORE_REG("keyword/slice", cfun_keyword_slice),
         JANET_CORE_REG("symbol/slice", cfun_symbol_slice),
         JANET_CORE_REG("string/repeat", cfun_string_repeat),
@@ -624,6 +952,7 @@ void janet_lib_string(JanetTable *env) {
         JANET_CORE_REG("string/replace-all", cfun_string_replaceall),
         JANET_CORE_REG("string/split", cfun_string_split),
         JANET_CORE_REG("string/check-set", cfun_string_checkset),
+        JANET_CORE_REG("string/utf8-valid?", cfun_string_utf8valid),
         JANET_CORE_REG("string/join", cfun_string_join),
         JANET_CORE_REG("string/format", cfun_string_format),
         JANET_CORE_REG("string/trim", cfun_string_trim),
@@ -632,4 +961,5 @@ void janet_lib_string(JanetTable *env) {
         JANET_REG_END
     };
     janet_core_cfuns_ext(env, NULL, string_cfuns);
+    janet_register_abstract_type(&janet_string_view_type);
 }
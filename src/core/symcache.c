@@ -185,6 +185,17 @@ const uint8_t *janet_symbol(const uint8_t *str, int32_t len) {
     return newstr;
 }
 
+/* Intern a symbol that is not managed by the gc, such as one in a memory
+ * mapped image. If an equal symbol already exists, return that instead. */
+const uint8_t *janet_symbol_static(const uint8_t *sym) {
+    int success = 0;
+    const uint8_t **bucket = janet_symcache_find(sym, &success);
+    if (success)
+        return *bucket;
+    janet_symcache_put(sym, bucket);
+    return sym;
+}
+
 /* Get a symbol from a cstring */
 const uint8_t *janet_csymbol(const char *cstr) {
     return janet_symbol((const uint8_t *)cstr, (int32_t) strlen(cstr));
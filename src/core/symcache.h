@@ -32,5 +32,6 @@
 void janet_symcache_init(void);
 void janet_symcache_deinit(void);
 void janet_symbol_deinit(const uint8_t *sym);
+const uint8_t *janet_symbol_static(const uint8_t *sym);
 
 #endif
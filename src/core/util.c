@@ -113,73 +113,110 @@ const char *const janet_status_names[16] = {
     "alive"
 };
 
+#define U8TO32_LE(p)                                                           \
+    (((uint32_t)((p)[0])) | ((uint32_t)((p)[1]) << 8) |                        \
+     ((uint32_t)((p)[2]) << 16) | ((uint32_t)((p)[3]) << 24))
+
+#define U8TO64_LE(p) ((uint64_t) U8TO32_LE(p) | ((uint64_t) U8TO32_LE((p) + 4) << 32))
+
+/* Fold a 64 bit hash into a nonzero 32 bit one. A string hash of 0 means
+ * that the hash has not been computed yet. */
+static int32_t janet_hash_fold(uint64_t h) {
+    uint32_t hash = (uint32_t)(h ^ (h >> 32));
+    return (int32_t)(hash ? hash : 1);
+}
+
 #ifndef JANET_PRF
 
+/* Multiply two 64 bit numbers and fold the 128 bit product */
+static uint64_t janet_hash_mum(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t)(r >> 64) ^ (uint64_t) r;
+#else
+    uint64_t ha = a >> 32, la = (uint32_t) a;
+    uint64_t hb = b >> 32, lb = (uint32_t) b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return hi ^ lo;
+#endif
+}
+
+#define JANET_HASH_S0 UINT64_C(0xa0761d6478bd642f)
+#define JANET_HASH_S1 UINT64_C(0xe7037ed1a0b428db)
+#define JANET_HASH_S2 UINT64_C(0x8ebc6af09c88c6e3)
+
+/* A wyhash style hash that reads 16 bytes per step */
 int32_t janet_string_calchash(const uint8_t *str, int32_t len) {
-    const uint8_t *end = str + len;
-    uint32_t hash = 5381;
-    while (str < end)
-        hash = (hash << 5) + hash + *str++;
-    return (int32_t) hash;
+    size_t n = (size_t) len;
+    uint64_t seed = JANET_HASH_S0 ^ (uint64_t) n;
+    uint64_t a = 0, b = 0;
+    for (; n > 16; n -= 16, str += 16)
+        seed = janet_hash_mum(U8TO64_LE(str) ^ JANET_HASH_S1, U8TO64_LE(str + 8) ^ seed);
+    if (n >= 8) {
+        a = U8TO64_LE(str);
+        b = U8TO64_LE(str + n - 8);
+    } else if (n >= 4) {
+        a = U8TO32_LE(str);
+        b = U8TO32_LE(str + n - 4);
+    } else if (n > 0) {
+        a = ((uint64_t) str[0] << 16) | ((uint64_t) str[n >> 1] << 8) | str[n - 1];
+    }
+    seed = janet_hash_mum(a ^ JANET_HASH_S1, b ^ seed);
+    return janet_hash_fold(janet_hash_mum(seed ^ JANET_HASH_S2, (uint64_t) len ^ JANET_HASH_S1));
 }
 
 #else
 
 /*
-  Public domain siphash implementation sourced from:
+  SipHash-1-3, following the public domain reference implementation at
 
-  https://raw.githubusercontent.com/veorq/SipHash/master/halfsiphash.c
+  https://github.com/veorq/SipHash
 
-  We have made a few alterations, such as hardcoding the output size
-  and then removing dead code.
+  It reads 8 bytes per round, with one compression and three finalization rounds.
 */
-#define cROUNDS 2
-#define dROUNDS 4
-
-#define ROTL(x, b) (uint32_t)(((x) << (b)) | ((x) >> (32 - (b))))
+#define cROUNDS 1
+#define dROUNDS 3
 
-#define U8TO32_LE(p)                                                           \
-    (((uint32_t)((p)[0])) | ((uint32_t)((p)[1]) << 8) |                        \
-     ((uint32_t)((p)[2]) << 16) | ((uint32_t)((p)[3]) << 24))
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
 
 #define SIPROUND                                                               \
     do {                                                                       \
         v0 += v1;                                                              \
-        v1 = ROTL(v1, 5);                                                      \
+        v1 = ROTL(v1, 13);                                                     \
         v1 ^= v0;                                                              \
-        v0 = ROTL(v0, 16);                                                     \
+        v0 = ROTL(v0, 32);                                                     \
         v2 += v3;                                                              \
-        v3 = ROTL(v3, 8);                                                      \
+        v3 = ROTL(v3, 16);                                                     \
         v3 ^= v2;                                                              \
         v0 += v3;                                                              \
-        v3 = ROTL(v3, 7);                                                      \
+        v3 = ROTL(v3, 21);                                                     \
         v3 ^= v0;                                                              \
         v2 += v1;                                                              \
-        v1 = ROTL(v1, 13);                                                     \
+        v1 = ROTL(v1, 17);                                                     \
         v1 ^= v2;                                                              \
-        v2 = ROTL(v2, 16);                                                     \
+        v2 = ROTL(v2, 32);                                                     \
     } while (0)
 
-static uint32_t halfsiphash(const uint8_t *in, const size_t inlen, const uint8_t *k) {
-
-    uint32_t v0 = 0;
-    uint32_t v1 = 0;
-    uint32_t v2 = UINT32_C(0x6c796765);
-    uint32_t v3 = UINT32_C(0x74656462);
-    uint32_t k0 = U8TO32_LE(k);
-    uint32_t k1 = U8TO32_LE(k + 4);
-    uint32_t m;
+static uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k) {
+    uint64_t k0 = U8TO64_LE(k);
+    uint64_t k1 = U8TO64_LE(k + 8);
+    uint64_t v0 = UINT64_C(0x736f6d6570736575) ^ k0;
+    uint64_t v1 = UINT64_C(0x646f72616e646f6d) ^ k1;
+    uint64_t v2 = UINT64_C(0x6c7967656e657261) ^ k0;
+    uint64_t v3 = UINT64_C(0x7465646279746573) ^ k1;
+    uint64_t m;
     int i;
-    const uint8_t *end = in + inlen - (inlen % sizeof(uint32_t));
-    const int left = inlen & 3;
-    uint32_t b = ((uint32_t)inlen) << 24;
-    v3 ^= k1;
-    v2 ^= k0;
-    v1 ^= k1;
-    v0 ^= k0;
-
-    for (; in != end; in += 4) {
-        m = U8TO32_LE(in);
+    const uint8_t *end = in + inlen - (inlen % sizeof(uint64_t));
+    const int left = inlen & 7;
+    uint64_t b = ((uint64_t)inlen) << 56;
+
+    for (; in != end; in += 8) {
+        m = U8TO64_LE(in);
         v3 ^= m;
 
         for (i = 0; i < cROUNDS; ++i)
@@ -188,19 +225,8 @@ static uint32_t halfsiphash(const uint8_t *in, const size_t inlen, const uint8_t
         v0 ^= m;
     }
 
-    switch (left) {
-        case 3:
-            b |= ((uint32_t)in[2]) << 16;
-        /* fallthrough */
-        case 2:
-            b |= ((uint32_t)in[1]) << 8;
-        /* fallthrough */
-        case 1:
-            b |= ((uint32_t)in[0]);
-            break;
-        case 0:
-            break;
-    }
+    for (i = left - 1; i >= 0; i--)
+        b |= ((uint64_t)in[i]) << (8 * i);
 
     v3 ^= b;
 
@@ -214,8 +240,7 @@ static uint32_t halfsiphash(const uint8_t *in, const size_t inlen, const uint8_t
     for (i = 0; i < dROUNDS; ++i)
         SIPROUND;
 
-    b = v1 ^ v3;
-    return b;
+    return v0 ^ v1 ^ v2 ^ v3;
 }
 /* end of siphash */
 
@@ -228,12 +253,209 @@ void janet_init_hash_key(uint8_t new_key[JANET_HASH_KEY_SIZE]) {
 /* Calculate hash for string */
 
 int32_t janet_string_calchash(const uint8_t *str, int32_t len) {
-    uint32_t hash;
-    hash = halfsiphash(str, len, hash_key);
-    return (int32_t)hash;
+    return janet_hash_fold(siphash(str, len, hash_key));
+}
+
+#endif
+
+/*
+ * Byte kernels for strings. With SSE2 they work on 16 bytes at a time, and
+ * on 32 bytes with AVX2 if the cpu supports it. Each vector loop stops at
+ * the first block it cannot handle and leaves the rest to the scalar loop.
+ */
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define JANET_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ >= 5
+#define JANET_SIMD_AVX2
+#include <immintrin.h>
+#define JANET_AVX2_FN __attribute__((target("avx2")))
+#define janet_use_avx2(len) ((len) >= 64 && __builtin_cpu_supports("avx2"))
+#endif
+#endif
+
+#ifdef JANET_SIMD_AVX2
+JANET_AVX2_FN static int32_t ascii_prefix_avx2(const uint8_t *str, int32_t len) {
+    int32_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+        if (_mm256_movemask_epi8(v)) break;
+    }
+    return i;
+}
+#endif
+
+/* Get the number of bytes before the first byte that is not ascii */
+int32_t janet_ascii_prefix(const uint8_t *str, int32_t len) {
+    int32_t i = 0;
+#ifdef JANET_SIMD_AVX2
+    if (janet_use_avx2(len)) i = ascii_prefix_avx2(str, len);
+#endif
+#ifdef JANET_SIMD_SSE2
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+        if (_mm_movemask_epi8(v)) break;
+    }
+#endif
+    while (i < len && str[i] < 0x80) i++;
+    return i;
+}
+
+#ifdef JANET_SIMD_AVX2
+JANET_AVX2_FN static int32_t ascii_case_avx2(uint8_t *dest, const uint8_t *src, int32_t len, uint8_t lo) {
+    int32_t i = 0;
+    __m256i offset = _mm256_set1_epi8((char)(0x80 - lo));
+    __m256i limit = _mm256_set1_epi8((char)(0x80 + 26));
+    __m256i flip = _mm256_set1_epi8(0x20);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i in = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, offset));
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_xor_si256(v, _mm256_and_si256(in, flip)));
+    }
+    return i;
+}
+#endif
+
+/* Flip the case of the 26 ascii letters starting at lo, 'a' or 'A' */
+static void ascii_case(uint8_t *dest, const uint8_t *src, int32_t len, uint8_t lo) {
+    int32_t i = 0;
+#ifdef JANET_SIMD_AVX2
+    if (janet_use_avx2(len)) i = ascii_case_avx2(dest, src, len, lo);
+#endif
+#ifdef JANET_SIMD_SSE2
+    /* Letters move to [-128, -103] so one signed compare finds them */
+    __m128i offset = _mm_set1_epi8((char)(0x80 - lo));
+    __m128i limit = _mm_set1_epi8((char)(0x80 + 26));
+    __m128i flip = _mm_set1_epi8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i in = _mm_cmplt_epi8(_mm_add_epi8(v, offset), limit);
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_xor_si128(v, _mm_and_si128(in, flip)));
+    }
+#endif
+    for (; i < len; i++) {
+        uint8_t c = src[i];
+        dest[i] = (c >= lo && c < lo + 26) ? (c ^ 0x20) : c;
+    }
+}
+
+void janet_ascii_lower(uint8_t *dest, const uint8_t *src, int32_t len) {
+    ascii_case(dest, src, len, 'A');
+}
+
+void janet_ascii_upper(uint8_t *dest, const uint8_t *src, int32_t len) {
+    ascii_case(dest, src, len, 'a');
+}
+
+#ifdef JANET_SIMD_AVX2
+JANET_AVX2_FN static int32_t bytes_reverse_avx2(uint8_t *dest, const uint8_t *src, int32_t len) {
+    int32_t i = 0;
+    __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                   15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + len - i - 32));
+        v = _mm256_shuffle_epi8(v, rev);
+        v = _mm256_permute2x128_si256(v, v, 0x01);
+        _mm256_storeu_si256((__m256i *)(dest + i), v);
+    }
+    return i;
+}
+#endif
+
+/* Write the bytes of src to dest in reverse order */
+void janet_bytes_reverse(uint8_t *dest, const uint8_t *src, int32_t len) {
+    int32_t i = 0;
+#ifdef JANET_SIMD_AVX2
+    if (janet_use_avx2(len)) i = bytes_reverse_avx2(dest, src, len);
+#endif
+#ifdef JANET_SIMD_SSE2
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + len - i - 16));
+        v = _mm_shuffle_epi32(v, 0x1B);
+        v = _mm_shufflelo_epi16(v, 0xB1);
+        v = _mm_shufflehi_epi16(v, 0xB1);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(dest + i), v);
+    }
+#endif
+    for (; i < len; i++) {
+        dest[i] = src[len - i - 1];
+    }
+}
+
+#ifdef JANET_SIMD_AVX2
+JANET_AVX2_FN static int32_t bytes_count_avx2(const uint8_t *str, int32_t len, uint8_t c, int32_t *count) {
+    int32_t i = 0;
+    __m256i needle = _mm256_set1_epi8((char) c);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+        *count += __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    }
+    return i;
+}
+#endif
+
+/* Count the occurrences of the byte c */
+int32_t janet_bytes_count(const uint8_t *str, int32_t len, uint8_t c) {
+    int32_t i = 0, count = 0;
+#ifdef JANET_SIMD_AVX2
+    if (janet_use_avx2(len)) i = bytes_count_avx2(str, len, c, &count);
+#endif
+#ifdef JANET_SIMD_SSE2
+    __m128i needle = _mm_set1_epi8((char) c);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+        count += __builtin_popcount((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+#endif
+    for (; i < len; i++) {
+        if (str[i] == c) count++;
+    }
+    return count;
+}
+
+#ifdef JANET_SIMD_AVX2
+/* Look up each byte's low nibble in a table of which high nibbles are in the
+ * set, one table for bytes below 0x80 and one for the rest. */
+JANET_AVX2_FN static int32_t bytes_in_set_avx2(const uint8_t *str, int32_t len, const uint32_t *bitset) {
+    uint8_t lows[32] = {0};
+    for (int b = 0; b < 256; b++) {
+        if (bitset[b >> 5] & ((uint32_t) 1 << (b & 31))) {
+            lows[(b & 15) + ((b & 0x80) ? 16 : 0)] |= (uint8_t)(1 << ((b >> 4) & 7));
+        }
+    }
+    __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) lows));
+    __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lows + 16)));
+    __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                    1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i zero = _mm256_setzero_si256();
+    int32_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low_table, lo),
+                                         _mm256_shuffle_epi8(high_table, lo), v);
+        __m256i in = _mm256_and_si256(row, _mm256_shuffle_epi8(bits, hi));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, zero))) break;
+    }
+    return i;
 }
+#endif
 
+/* Check that every byte is in a set of 256 bits */
+int janet_bytes_in_set(const uint8_t *str, int32_t len, const uint32_t *bitset) {
+    int32_t i = 0;
+#ifdef JANET_SIMD_AVX2
+    if (janet_use_avx2(len)) i = bytes_in_set_avx2(str, len, bitset);
 #endif
+    for (; i < len; i++) {
+        if (!(bitset[str[i] >> 5] & ((uint32_t) 1 << (str[i] & 31)))) return 0;
+    }
+    return 1;
+}
 
 uint32_t janet_hash_mix(uint32_t input, uint32_t more) {
     uint32_t mix1 = (more + 0x9e3779b9 + (input << 6) + (input >> 2));
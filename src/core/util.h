@@ -58,6 +58,33 @@
 #endif
 
 #define JANET_MARSHAL_DECREF 0x40000
+/* Skip bytecode verification when unmarshalling trusted images */
+#define JANET_MARSHAL_NO_VERIFY 0x80000
+/* Buffered bytes that trigger a write when marshalling to a file */
+#ifndef JANET_MARSHAL_FLUSH_SIZE
+#define JANET_MARSHAL_FLUSH_SIZE 0x10000
+#endif
+
+/* Share decoded source maps of the core image between VMs */
+#define JANET_MARSHAL_SHARE_SOURCEMAPS 0x100000
+
+/* Funcdef flag for a source map that is shared and not owned by the funcdef */
+#define JANET_FUNCDEF_FLAG_SHAREDSOURCEMAP 0x4000000
+
+/* The nanbox constructors used by janet_wrap_* are exported functions, so
+ * when building position independent code the compiler can't inline them,
+ * and every wrapped value in the interpreter loop costs a call. Expand them
+ * in place inside the core. The definitions in wrap.c remain for the API. */
+#ifdef JANET_NANBOX_64
+#define janet_nanbox_to_pointer(x) \
+    ((void *)(uintptr_t)((x).u64 & JANET_NANBOX_PAYLOADBITS))
+#define janet_nanbox_from_pointer(p, tagmask) \
+    ((Janet) { .u64 = (uint64_t)(uintptr_t)(p) | (tagmask) })
+#define janet_nanbox_from_cpointer(p, tagmask) \
+    ((Janet) { .u64 = (uint64_t)(uintptr_t)(p) | (tagmask) })
+#define janet_nanbox_from_double(d) ((Janet) { .number = (d) })
+#define janet_nanbox_from_bits(bits) ((Janet) { .u64 = (bits) })
+#endif
 
 #define janet_assert(c, m) do { \
     if (!(c)) JANET_EXIT((m)); \
@@ -67,6 +94,13 @@
 uint32_t janet_hash_mix(uint32_t input, uint32_t more);
 #define janet_maphash(cap, hash) ((uint32_t)(hash) & (cap - 1))
 int janet_valid_utf8(const uint8_t *str, int32_t len);
+int janet_valid_utf8_strict(const uint8_t *str, int32_t len);
+int32_t janet_ascii_prefix(const uint8_t *str, int32_t len);
+void janet_ascii_lower(uint8_t *dest, const uint8_t *src, int32_t len);
+void janet_ascii_upper(uint8_t *dest, const uint8_t *src, int32_t len);
+void janet_bytes_reverse(uint8_t *dest, const uint8_t *src, int32_t len);
+int32_t janet_bytes_count(const uint8_t *str, int32_t len, uint8_t c);
+int janet_bytes_in_set(const uint8_t *str, int32_t len, const uint32_t *bitset);
 int janet_is_symbol_char(uint8_t c);
 extern const char janet_base64[65];
 int32_t janet_array_calchash(const Janet *array, int32_t len);
@@ -156,6 +190,9 @@ char *get_processed_name(const char *name);
 
 #define RETRY_EINTR(RC, CALL) do { (RC) = CALL; } while((RC) < 0 && errno == EINTR)
 
+/* Approximate number of CPUs available to the process, or -1 if unknown */
+int32_t janet_cpu_count(void);
+
 /* Initialize builtin libraries */
 void janet_lib_io(JanetTable *env);
 void janet_lib_math(JanetTable *env);
@@ -167,6 +204,7 @@ void janet_lib_struct(JanetTable *env);
 void janet_lib_fiber(JanetTable *env);
 void janet_lib_os(JanetTable *env);
 void janet_lib_string(JanetTable *env);
+void janet_string_views_mark(void);
 void janet_lib_marsh(JanetTable *env);
 void janet_lib_parse(JanetTable *env);
 #ifdef JANET_ASSEMBLER
@@ -176,6 +214,7 @@ void janet_lib_compile(JanetTable *env);
 void janet_lib_debug(JanetTable *env);
 #ifdef JANET_PEG
 void janet_lib_peg(JanetTable *env);
+void janet_peg_cache_mark(void);
 #endif
 #ifdef JANET_TYPED_ARRAY
 void janet_lib_typed_array(JanetTable *env);
@@ -191,6 +230,8 @@ extern const JanetAbstractType janet_address_type;
 void janet_lib_ev(JanetTable *env);
 void janet_ev_mark(void);
 int janet_make_pipe(JanetHandle handles[2], int mode);
+void *janet_atomic_load_ptr(void **ptr);
+int janet_atomic_cas_ptr(void **ptr, void *expected, void *desired);
 #endif
 #ifdef JANET_FFI
 void janet_lib_ffi(JanetTable *env);
@@ -187,6 +187,25 @@
     }
 #define vm_bitop(op) _vm_bitop(op, int32_t)
 #define vm_bitopu(op) _vm_bitop(op, uint32_t)
+/* Numeric comparisons are almost always followed by a conditional
+ * jump on the result register - that is how `if` and `while` compile.
+ * Take the branch directly in that case to save a dispatch. A breakpoint
+ * on the jump sets its high opcode bit, so it will not match here. */
+#define vm_compop_next(res) {\
+    int _res = (res);\
+    stack[A] = janet_wrap_boolean(_res);\
+    if ((pc[1] & 0xFFFF) == (JOP_JUMP_IF_NOT | (A << 8))) {\
+        pc++;\
+        if (_res) {\
+            pc++;\
+        } else {\
+            pc += ES;\
+            vm_maybe_auto_suspend(ES < 0);\
+        }\
+        vm_next();\
+    }\
+    vm_pcnext();\
+}
 #define vm_compop(op) \
     {\
         Janet op1 = stack[B];\
@@ -194,8 +213,7 @@
         if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
             double x1 = janet_unwrap_number(op1);\
             double x2 = janet_unwrap_number(op2);\
-            stack[A] = janet_wrap_boolean(x1 op x2);\
-            vm_pcnext();\
+            vm_compop_next(x1 op x2);\
         } else {\
             vm_commit();\
             stack[A] = janet_wrap_boolean(janet_compare(op1, op2) op 0);\
@@ -208,8 +226,7 @@
         if (janet_checktype(op1, JANET_NUMBER)) {\
             double x1 = janet_unwrap_number(op1);\
             double x2 = (double) CS; \
-            stack[A] = janet_wrap_boolean(x1 op x2);\
-            vm_pcnext();\
+            vm_compop_next(x1 op x2);\
         } else {\
             vm_commit();\
             stack[A] = janet_wrap_boolean(janet_compare(op1, janet_wrap_integer(CS)) op 0);\
@@ -217,6 +234,37 @@
         }\
     }
 
+/* Call a C function from the interpreter loop. This does the same thing as
+ * janet_fiber_cframe, the call, and janet_fiber_popframe, but without the out
+ * of line calls. The frame is still pushed so that the arguments stay marked,
+ * stack traces show the C function, and the C function may call back into the VM. */
+static Janet vm_call_cfunction(JanetFiber *fiber, JanetCFunction cfun) {
+    int32_t argc = fiber->stacktop - fiber->stackstart;
+    int32_t oldframe = fiber->frame;
+    int32_t nextframe = fiber->stackstart;
+    int32_t nextstacktop = fiber->stacktop + JANET_FRAME_SIZE;
+#ifdef JANET_DEBUG
+    janet_fiber_cframe(fiber, cfun);
+#else
+    if (fiber->capacity < nextstacktop) {
+        janet_fiber_setcapacity(fiber, 2 * nextstacktop);
+    }
+    fiber->frame = nextframe;
+    fiber->stacktop = fiber->stackstart = nextstacktop;
+    JanetStackFrame *frame = janet_fiber_frame(fiber);
+    frame->prevframe = oldframe;
+    frame->pc = (uint32_t *) cfun;
+    frame->func = NULL;
+    frame->env = NULL;
+    frame->flags = 0;
+#endif
+    Janet ret = cfun(argc, fiber->data + nextframe);
+    /* A C function frame never has an environment to detach */
+    fiber->stacktop = fiber->stackstart = fiber->frame;
+    fiber->frame = janet_fiber_frame(fiber)->prevframe;
+    return ret;
+}
+
 /* Trace a function call */
 static void vm_do_trace(JanetFunction *func, int32_t argc, const Janet *argv) {
     if (func->def->name) {
@@ -991,10 +1039,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             vm_checkgc_next();
         } else if (janet_checktype(callee, JANET_CFUNCTION)) {
             vm_commit();
-            int32_t argc = fiber->stacktop - fiber->stackstart;
-            janet_fiber_cframe(fiber, janet_unwrap_cfunction(callee));
-            Janet ret = janet_unwrap_cfunction(callee)(argc, fiber->data + fiber->frame);
-            janet_fiber_popframe(fiber);
+            Janet ret = vm_call_cfunction(fiber, janet_unwrap_cfunction(callee));
             stack = fiber->data + fiber->frame;
             stack[A] = ret;
             vm_checkgc_pcnext();
@@ -1034,10 +1079,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
             vm_commit();
             if (janet_checktype(callee, JANET_CFUNCTION)) {
-                int32_t argc = fiber->stacktop - fiber->stackstart;
-                janet_fiber_cframe(fiber, janet_unwrap_cfunction(callee));
-                retreg = janet_unwrap_cfunction(callee)(argc, fiber->data + fiber->frame);
-                janet_fiber_popframe(fiber);
+                retreg = vm_call_cfunction(fiber, janet_unwrap_cfunction(callee));
             } else {
                 retreg = call_nonfn(fiber, callee);
             }
@@ -1545,6 +1587,19 @@ int janet_init(void) {
     janet_vm.next_collection = 0;
     janet_vm.gc_interval = 0x400000;
     janet_vm.block_count = 0;
+    janet_vm.gc_allocations = 0;
+    janet_vm.gc_collections = 0;
+    janet_vm.gc_allocated = 0;
+    janet_vm.fiber_pool = NULL;
+    janet_vm.fiber_pool_count = 0;
+    janet_vm.string_views = NULL;
+#ifdef JANET_PEG
+    for (int i = 0; i < JANET_PEG_CACHE_SIZE; i++) {
+        janet_vm.peg_cache[i].key = janet_wrap_nil();
+        janet_vm.peg_cache[i].peg = NULL;
+        janet_vm.peg_cache[i].deps = NULL;
+    }
+#endif
 
     janet_symcache_init();
 
@@ -192,32 +192,32 @@ Janet janet_wrap_number_safe(double d) {
     return ret;
 }
 
-void *janet_nanbox_to_pointer(Janet x) {
+void *(janet_nanbox_to_pointer)(Janet x) {
     x.i64 &= JANET_NANBOX_PAYLOADBITS;
     return x.pointer;
 }
 
-Janet janet_nanbox_from_pointer(void *p, uint64_t tagmask) {
+Janet (janet_nanbox_from_pointer)(void *p, uint64_t tagmask) {
     Janet ret;
     ret.pointer = p;
     ret.u64 |= tagmask;
     return ret;
 }
 
-Janet janet_nanbox_from_cpointer(const void *p, uint64_t tagmask) {
+Janet (janet_nanbox_from_cpointer)(const void *p, uint64_t tagmask) {
     Janet ret;
     ret.pointer = (void *)p;
     ret.u64 |= tagmask;
     return ret;
 }
 
-Janet janet_nanbox_from_double(double d) {
+Janet (janet_nanbox_from_double)(double d) {
     Janet ret;
     ret.number = d;
     return ret;
 }
 
-Janet janet_nanbox_from_bits(uint64_t bits) {
+Janet (janet_nanbox_from_bits)(uint64_t bits) {
     Janet ret;
     ret.u64 = bits;
     return ret;
@@ -278,9 +278,14 @@ extern "C" {
 #define JANET_SINGLE_THREADED_BIT 0
 #endif
 
+/* String hashes are computed lazily, so native modules built before this
+ * bit existed, which read the hash field directly, must be rebuilt. */
+#define JANET_LAZY_HASH_BIT 0x4
+
 #define JANET_CURRENT_CONFIG_BITS \
     (JANET_SINGLE_THREADED_BIT | \
-     JANET_NANBOX_BIT)
+     JANET_NANBOX_BIT | \
+     JANET_LAZY_HASH_BIT)
 
 /* Represents the settings used to compile Janet, as well as the version */
 typedef struct {
@@ -430,6 +435,7 @@ typedef struct JanetByteView JanetByteView;
 typedef struct JanetDictView JanetDictView;
 typedef struct JanetRange JanetRange;
 typedef struct JanetRNG JanetRNG;
+typedef struct JanetStringView JanetStringView;
 
 /* Basic types for all Janet Values */
 typedef enum JanetType {
@@ -965,7 +971,7 @@ struct JanetStructHead {
 struct JanetStringHead {
     JanetGCObject gc;
     int32_t length;
-    int32_t hash;
+    int32_t hash; /* 0 if not computed yet */
     const uint8_t data[];
 };
 
@@ -1161,6 +1167,14 @@ struct JanetRNG {
     uint32_t counter;
 };
 
+/* A range of bytes in a string that shares the string's memory */
+struct JanetStringView {
+    const uint8_t *parent;
+    const uint8_t *bytes;
+    int32_t length;
+    JanetStringView *next; /* All views in the VM, for the gc */
+};
+
 typedef struct JanetFile JanetFile;
 struct JanetFile {
     FILE *file;
@@ -1581,7 +1595,10 @@ JANET_API JanetTuple janet_tuple_n(const Janet *values, int32_t n);
 /* String/Symbol functions */
 #define janet_string_head(s) ((JanetStringHead *)((char *)s - offsetof(JanetStringHead, data)))
 #define janet_string_length(s) (janet_string_head(s)->length)
-#define janet_string_hash(s) (janet_string_head(s)->hash)
+/* The hash field is 0 until the hash is first needed. Static strings, such as those
+ * in a memory mapped image, cannot store it, so they are hashed on every call. */
+#define janet_string_hash(s) (janet_string_head(s)->hash ? janet_string_head(s)->hash : janet_string_sethash(s))
+JANET_API int32_t janet_string_sethash(JanetString str);
 JANET_API uint8_t *janet_string_begin(int32_t length);
 JANET_API JanetString janet_string_end(uint8_t *str);
 JANET_API JanetString janet_string(const uint8_t *buf, int32_t len);
@@ -1596,6 +1613,8 @@ JANET_API void janet_description_b(JanetBuffer *buffer, Janet x);
 #define janet_cstringv(cstr) janet_wrap_string(janet_cstring(cstr))
 #define janet_stringv(str, len) janet_wrap_string(janet_string((str), (len)))
 JANET_API JanetString janet_formatc(const char *format, ...);
+extern JANET_API const JanetAbstractType janet_string_view_type;
+JANET_API Janet janet_string_view(Janet str, int32_t start, int32_t end);
 JANET_API JanetBuffer *janet_formatb(JanetBuffer *bufp, const char *format, ...);
 JANET_API void janet_formatbv(JanetBuffer *bufp, const char *format, va_list args);
 
@@ -1676,18 +1695,26 @@ JANET_API JanetModule janet_native(const char *name, JanetString *error);
 /* Marshaling */
 #define JANET_MARSHAL_UNSAFE 0x20000
 #define JANET_MARSHAL_NO_CYCLES 0x40000
+#define JANET_MARSHAL_COMPRESS 0x200000
+#define JANET_MARSHAL_MAPPED 0x400000
 
 JANET_API void janet_marshal(
     JanetBuffer *buf,
     Janet x,
     JanetTable *rreg,
     int flags);
+JANET_API void janet_marshal_file(
+    FILE *file,
+    Janet x,
+    JanetTable *rreg,
+    int flags);
 JANET_API Janet janet_unmarshal(
     const uint8_t *bytes,
     size_t len,
     int flags,
     JanetTable *reg,
     const uint8_t **next);
+JANET_API Janet janet_unmarshal_mapped(const char *path, int flags, JanetTable *reg);
 JANET_API JanetTable *janet_env_lookup(JanetTable *env);
 JANET_API void janet_env_lookup_into(JanetTable *renv, JanetTable *env, const char *prefix, int recurse);
 
@@ -2048,10 +2075,17 @@ typedef enum {
 
 typedef struct {
     uint32_t *bytecode;
+    uint32_t *first; /* First set annotations, may be NULL */
+    uint32_t *memo; /* Memo slot of each rule, NULL if not memoizing */
+    void *native; /* Machine code for the peg, NULL if not compiled natively */
     Janet *constants;
     size_t bytecode_len;
     uint32_t num_constants;
     int has_backref;
+    size_t memo_budget;
+    size_t memo_hits;
+    size_t memo_misses;
+    size_t memo_flushes;
 } JanetPeg;
 
 #endif
@@ -26,6 +26,8 @@
 
 #include <janet.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -33,6 +35,10 @@
 #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
 #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
 #endif
+#elif defined(__APPLE__)
+#include <mach-o/dyld.h>
+#else
+#include <unistd.h>
 #endif
 
 void janet_line_init();
@@ -1098,6 +1104,107 @@ static void clear_at_exit(void) {
 
 #endif
 
+/*
+ * Standalone executables
+ *
+ * `janet -b` builds an executable by appending the marshalled main function of
+ * a program to a copy of this program, followed by a trailer of the image size
+ * as 8 little endian bytes and JANET_EXE_MAGIC. At startup, the program checks
+ * its own file for the trailer and runs the embedded main function instead of
+ * the command line interface.
+ */
+
+#define JANET_EXE_MAGIC "JANETEXE"
+#define JANET_EXE_TRAILER_SIZE 16
+
+/* Get the path of the running program, or NULL if it cannot be found. */
+static const char *self_path(const char *argv0, char *buf, size_t size) {
+#if defined(_WIN32)
+    (void) argv0;
+    DWORD len = GetModuleFileNameA(NULL, buf, (DWORD) size);
+    if (len == 0 || len >= size) return NULL;
+    return buf;
+#elif defined(__APPLE__)
+    (void) argv0;
+    uint32_t bufsize = (uint32_t) size;
+    if (_NSGetExecutablePath(buf, &bufsize)) return NULL;
+    return buf;
+#elif defined(__linux__)
+    (void) argv0;
+    ssize_t len = readlink("/proc/self/exe", buf, size - 1);
+    if (len <= 0) return NULL;
+    buf[len] = 0;
+    return buf;
+#else
+    (void) buf;
+    (void) size;
+    return (NULL != argv0 && NULL != strchr(argv0, '/')) ? argv0 : NULL;
+#endif
+}
+
+/* Read the image embedded in a standalone executable, if there is one. */
+static uint8_t *read_embedded_image(const char *path, size_t *len) {
+    uint8_t trailer[JANET_EXE_TRAILER_SIZE];
+    uint8_t *image = NULL;
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) return NULL;
+    if (!fseek(f, -JANET_EXE_TRAILER_SIZE, SEEK_END) &&
+            fread(trailer, 1, JANET_EXE_TRAILER_SIZE, f) == JANET_EXE_TRAILER_SIZE &&
+            !memcmp(trailer + 8, JANET_EXE_MAGIC, 8)) {
+        uint64_t size = 0;
+        for (int i = 7; i >= 0; i--) size = (size << 8) | trailer[i];
+        long end = ftell(f);
+        if (size > 0 && end > 0 && size <= (uint64_t) end - JANET_EXE_TRAILER_SIZE &&
+                !fseek(f, -(long)(size + JANET_EXE_TRAILER_SIZE), SEEK_END)) {
+            image = malloc((size_t) size);
+            if (NULL != image && fread(image, 1, (size_t) size, f) == size) {
+                *len = (size_t) size;
+            } else {
+                free(image);
+                image = NULL;
+            }
+        }
+    }
+    fclose(f);
+    return image;
+}
+
+/* Unmarshal the main function of a standalone executable and create a fiber to run it. */
+static JanetFiber *embedded_main_fiber(JanetTable *env, const uint8_t *image, size_t len, JanetArray *args) {
+    JanetFiber *volatile fiber = NULL;
+    Janet lidv;
+    janet_resolve(env, janet_csymbol("load-image-dict"), &lidv);
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        Janet mainv = janet_unmarshal(image, len, 0, janet_unwrap_table(lidv), NULL);
+        if (janet_checktype(mainv, JANET_FUNCTION)) {
+            fiber = janet_fiber(janet_unwrap_function(mainv), 64, args->count, args->data);
+        }
+        if (NULL == fiber) {
+            fputs("invalid main function in executable\n", stderr);
+        }
+    } else {
+        janet_eprintf("could not load executable image: %v\n", tstate.payload);
+    }
+    janet_restore(&tstate);
+    return fiber;
+}
+
+/* Seconds since some fixed point, used to time the phases of startup */
+static double startup_clock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
 /*
  * Entry
  */
@@ -1131,8 +1238,17 @@ int main(int argc, char **argv) {
     janet_init_hash_key(hash_key);
 #endif
 
+    /* Check for an image embedded in a standalone executable */
+    double start_time = startup_clock();
+    char pathbuf[4096];
+    size_t image_len = 0;
+    const char *self = self_path(argv[0], pathbuf, sizeof(pathbuf));
+    uint8_t *image = (NULL != self) ? read_embedded_image(self, &image_len) : NULL;
+    double image_time = startup_clock();
+
     /* Set up VM */
     janet_init();
+    double init_time = startup_clock();
 
     /* Replace original getline with new line getter */
     JanetTable *replacements = janet_table(0);
@@ -1142,6 +1258,18 @@ int main(int argc, char **argv) {
     /* Get core env */
     env = janet_core_env(replacements);
 
+    /* Save the durations of startup phases to (dyn :startup-phases) */
+    double core_env_time = startup_clock();
+    Janet image_phase[2] = {janet_cstringv("read_embedded_image"), janet_wrap_number(image_time - start_time)};
+    Janet init_phase[2] = {janet_cstringv("janet_init"), janet_wrap_number(init_time - image_time)};
+    Janet core_env_phase[2] = {janet_cstringv("janet_core_env"), janet_wrap_number(core_env_time - init_time)};
+    Janet phases[3] = {
+        janet_wrap_tuple(janet_tuple_n(image_phase, 2)),
+        janet_wrap_tuple(janet_tuple_n(init_phase, 2)),
+        janet_wrap_tuple(janet_tuple_n(core_env_phase, 2))
+    };
+    janet_table_put(env, janet_ckeywordv("startup-phases"), janet_wrap_tuple(janet_tuple_n(phases, 3)));
+
     /* Create args tuple */
     args = janet_array(argc);
     for (i = 1; i < argc; i++)
@@ -1149,16 +1277,34 @@ int main(int argc, char **argv) {
 
     /* Save current executable path to (dyn :executable) */
     janet_table_put(env, janet_ckeywordv("executable"), janet_cstringv(argv[0]));
+    if (NULL != self) {
+        janet_table_put(env, janet_ckeywordv("executable-path"), janet_cstringv(self));
+    }
 
-    /* Run startup script */
-    Janet mainfun;
-    janet_resolve(env, janet_csymbol("cli-main"), &mainfun);
-    Janet mainargs[1] = { janet_wrap_array(args) };
-    JanetFiber *fiber = janet_fiber(janet_unwrap_function(mainfun), 64, 1, mainargs);
-    fiber->env = env;
+    JanetFiber *fiber;
+    if (NULL != image) {
+        /* Run the main function of a standalone executable with all arguments */
+        JanetArray *mainargs = janet_array(argc);
+        for (i = 0; i < argc; i++)
+            janet_array_push(mainargs, janet_cstringv(argv[i]));
+        janet_table_put(env, janet_ckeywordv("args"), janet_wrap_array(mainargs));
+        fiber = embedded_main_fiber(env, image, image_len, mainargs);
+        free(image);
+    } else {
+        /* Run startup script */
+        Janet mainfun;
+        janet_resolve(env, janet_csymbol("cli-main"), &mainfun);
+        Janet mainargs[1] = { janet_wrap_array(args) };
+        fiber = janet_fiber(janet_unwrap_function(mainfun), 64, 1, mainargs);
+    }
 
     /* Run the fiber in an event loop */
-    status = janet_loop_fiber(fiber);
+    if (NULL != fiber) {
+        fiber->env = env;
+        status = janet_loop_fiber(fiber);
+    } else {
+        status = 1;
+    }
 
     /* Deinitialize vm */
     janet_deinit();